@@ -0,0 +1,440 @@
+/**
+ * @file action_log.h
+ * @author Chase Geigle
+ *
+ * A flat, append-only log of the actions extracted from a community, kept
+ * as one column per field and sorted by user and time with a parallel
+ * radix sort.
+ */
+
+#ifndef STACKEXCHANGE_ACTION_LOG_H_
+#define STACKEXCHANGE_ACTION_LOG_H_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "actions.h"
+#include "date.h"
+#include "parsing.h"
+
+#include "meta/io/filesystem.h"
+#include "meta/io/packed.h"
+#include "meta/parallel/thread_pool.h"
+
+class action_runs;
+
+/**
+ * Every action of every user, as (user, time, type) records of 9 bytes
+ * each. Times are kept to the second.
+ *
+ * A log can be given a cap on the number of actions it holds, past which
+ * it sorts them and writes them out as a run (see action_runs).
+ */
+class action_log
+{
+  public:
+    /// the memory an action takes up while the log is being sorted
+    static constexpr std::size_t sort_bytes = 18;
+
+    /**
+     * Whenever max_size actions have been appended, sorts them on pool
+     * and moves them to a new run in runs.
+     */
+    void spill_to(action_runs& runs, std::size_t max_size,
+                  meta::parallel::thread_pool& pool)
+    {
+        runs_ = &runs;
+        max_size_ = max_size;
+        pool_ = &pool;
+    }
+
+    void append(user_id user, sys_milliseconds date, action_type type)
+    {
+        using namespace std::chrono;
+
+        auto secs = duration_cast<seconds>(date.time_since_epoch()).count();
+        if (secs < 0 || secs > std::numeric_limits<uint32_t>::max())
+            throw std::out_of_range{"action date out of range"};
+
+        append(compact_user_id(user), static_cast<uint32_t>(secs), type);
+    }
+
+    /**
+     * Appends an action by its compacted user id and its time in seconds,
+     * as they are stored.
+     */
+    void append(uint32_t user, uint32_t time, action_type type)
+    {
+        users_.push_back(user);
+        times_.push_back(time);
+        types_.push_back(type);
+
+        if (runs_ && size() >= max_size_)
+            spill();
+    }
+
+    /**
+     * Sorts whatever actions are left and moves them to a new run.
+     */
+    void spill();
+
+    /**
+     * Moves every action of another log to the end of this one.
+     */
+    void append(action_log&& other)
+    {
+        users_.insert(users_.end(), other.users_.begin(), other.users_.end());
+        times_.insert(times_.end(), other.times_.begin(), other.times_.end());
+        types_.insert(types_.end(), other.types_.begin(), other.types_.end());
+        other = action_log{};
+    }
+
+    std::size_t size() const
+    {
+        return types_.size();
+    }
+
+    uint32_t user(std::size_t idx) const
+    {
+        return users_[idx];
+    }
+
+    /**
+     * @return the times of the actions, in seconds since the epoch
+     */
+    const uint32_t* times() const
+    {
+        return times_.data();
+    }
+
+    const action_type* types() const
+    {
+        return types_.data();
+    }
+
+    void save(std::ostream& output) const
+    {
+        meta::io::packed::write(output, users_);
+        meta::io::packed::write(output, times_);
+        meta::io::packed::write(output, types_);
+    }
+
+    static action_log load(std::istream& input)
+    {
+        action_log log;
+        meta::io::packed::read(input, log.users_);
+        meta::io::packed::read(input, log.times_);
+        meta::io::packed::read(input, log.types_);
+        if (log.users_.size() != log.types_.size()
+            || log.times_.size() != log.types_.size())
+            throw std::runtime_error{"corrupt action log"};
+        return log;
+    }
+
+    /**
+     * Sorts the log by user, then by time. Actions with the same user and
+     * time keep the order they were appended in.
+     */
+    void sort(meta::parallel::thread_pool& pool)
+    {
+        std::vector<uint64_t> keys(size());
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            keys[i] = uint64_t{users_[i]} << 32 | times_[i];
+        users_ = {};
+        times_ = {};
+
+        radix_sort(keys, types_, pool);
+
+        users_.resize(keys.size());
+        times_.resize(keys.size());
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            users_[i] = static_cast<uint32_t>(keys[i] >> 32);
+            times_[i] = static_cast<uint32_t>(keys[i]);
+        }
+    }
+
+  private:
+    using histogram = std::array<std::size_t, 256>;
+
+    /**
+     * A stable LSD radix sort of keys (and the values alongside them), one
+     * byte per pass. Each pass counts and scatters contiguous chunks on
+     * the pool; passes on a byte every key shares are skipped, which for
+     * user ids is most of the high ones.
+     */
+    static void radix_sort(std::vector<uint64_t>& keys,
+                           std::vector<action_type>& values,
+                           meta::parallel::thread_pool& pool)
+    {
+        auto num_chunks = std::max<std::size_t>(
+            1, std::min(pool.size(), keys.size() / 65536));
+        auto chunk_size = (keys.size() + num_chunks - 1) / num_chunks;
+
+        std::vector<uint64_t> keys_out(keys.size());
+        std::vector<action_type> values_out(values.size());
+        std::vector<histogram> counts(num_chunks);
+
+        for (uint32_t shift = 0; shift < 64; shift += 8)
+        {
+            for_each_chunk(keys.size(), num_chunks, chunk_size, pool,
+                           [&](std::size_t chunk, std::size_t first,
+                               std::size_t last) {
+                               auto& count = counts[chunk];
+                               count.fill(0);
+                               for (auto i = first; i < last; ++i)
+                                   ++count[keys[i] >> shift & 0xFF];
+                           });
+
+            // turn the counts into each chunk's starting offset for each
+            // digit: digits in order, and chunks in order within a digit
+            std::size_t offset = 0;
+            bool uniform = false;
+            for (std::size_t digit = 0; digit < 256; ++digit)
+            {
+                std::size_t total = 0;
+                for (auto& count : counts)
+                {
+                    auto num = count[digit];
+                    count[digit] = offset + total;
+                    total += num;
+                }
+                uniform = uniform || total == keys.size();
+                offset += total;
+            }
+            if (uniform)
+                continue;
+
+            for_each_chunk(keys.size(), num_chunks, chunk_size, pool,
+                           [&](std::size_t chunk, std::size_t first,
+                               std::size_t last) {
+                               auto& next = counts[chunk];
+                               for (auto i = first; i < last; ++i)
+                               {
+                                   auto pos = next[keys[i] >> shift & 0xFF]++;
+                                   keys_out[pos] = keys[i];
+                                   values_out[pos] = values[i];
+                               }
+                           });
+            keys.swap(keys_out);
+            values.swap(values_out);
+        }
+    }
+
+    template <class Function>
+    static void for_each_chunk(std::size_t size, std::size_t num_chunks,
+                               std::size_t chunk_size,
+                               meta::parallel::thread_pool& pool,
+                               Function&& fn)
+    {
+        std::vector<std::future<void>> futures;
+        for (std::size_t chunk = 0; chunk < num_chunks; ++chunk)
+        {
+            auto first = std::min(size, chunk * chunk_size);
+            auto last = std::min(size, first + chunk_size);
+            futures.push_back(pool.submit_task(
+                [&fn, chunk, first, last]() { fn(chunk, first, last); }));
+        }
+        for (auto& fut : futures)
+            fut.get();
+    }
+
+    std::vector<uint32_t> users_;
+    std::vector<uint32_t> times_;
+    std::vector<action_type> types_;
+
+    action_runs* runs_ = nullptr;
+    std::size_t max_size_ = 0;
+    meta::parallel::thread_pool* pool_ = nullptr;
+};
+
+/**
+ * Sorted runs of actions spilled to disk by action_logs, which are merged
+ * back together by user and time.
+ *
+ * Each run is a file of 9-byte (user, time, type) records named
+ * "<prefix>.N"; the files are removed once the runs are destroyed.
+ */
+class action_runs
+{
+  public:
+    action_runs(std::string prefix) : prefix_{std::move(prefix)}
+    {
+        // nothing
+    }
+
+    ~action_runs()
+    {
+        for (const auto& run : runs_)
+            meta::filesystem::delete_file(run);
+    }
+
+    /**
+     * Writes a sorted log out as the next run.
+     */
+    void write(const action_log& log)
+    {
+        runs_.push_back(prefix_ + "." + std::to_string(runs_.size()));
+        std::ofstream output{runs_.back(), std::ios::binary};
+
+        std::vector<char> buffer(record_size * 65536);
+        std::size_t pos = 0;
+        for (std::size_t i = 0; i < log.size(); ++i)
+        {
+            auto user = log.user(i);
+            std::memcpy(&buffer[pos], &user, 4);
+            std::memcpy(&buffer[pos + 4], log.times() + i, 4);
+            std::memcpy(&buffer[pos + 8], log.types() + i, 1);
+            pos += record_size;
+
+            if (pos == buffer.size())
+            {
+                output.write(buffer.data(),
+                             static_cast<std::streamsize>(pos));
+                pos = 0;
+            }
+        }
+        output.write(buffer.data(), static_cast<std::streamsize>(pos));
+        if (!output)
+            throw std::runtime_error{"failed to write " + runs_.back()};
+        num_actions_ += log.size();
+    }
+
+    /**
+     * @return the number of runs
+     */
+    std::size_t size() const
+    {
+        return runs_.size();
+    }
+
+    /**
+     * @return the number of actions in all of the runs
+     */
+    uint64_t num_actions() const
+    {
+        return num_actions_;
+    }
+
+    /**
+     * Merges the runs of several sets of runs, calling fn(user, time,
+     * type) for every action in order of user and time. Actions with the
+     * same user and time come out in run order, taking every run of the
+     * first set before those of the second, and so on, so the result is
+     * what sorting the concatenated logs would have produced.
+     */
+    static void merge(const std::vector<const action_runs*>& sets,
+                      const std::function<void(uint32_t, uint32_t,
+                                               action_type)>& fn)
+    {
+        std::vector<run_reader> readers;
+        for (const auto* set : sets)
+        {
+            for (const auto& run : set->runs_)
+                readers.emplace_back(run);
+        }
+
+        // (key, reader) pairs; a min-heap on the key then the reader
+        // index keeps ties in run order
+        using entry = std::pair<uint64_t, std::size_t>;
+        std::priority_queue<entry, std::vector<entry>, std::greater<entry>>
+            heap;
+        for (std::size_t i = 0; i < readers.size(); ++i)
+        {
+            if (readers[i].next())
+                heap.emplace(readers[i].key(), i);
+        }
+
+        while (!heap.empty())
+        {
+            auto idx = heap.top().second;
+            heap.pop();
+
+            auto& reader = readers[idx];
+            fn(reader.user, reader.time, reader.type);
+            if (reader.next())
+                heap.emplace(reader.key(), idx);
+        }
+    }
+
+  private:
+    static const std::size_t record_size = 9;
+
+    /**
+     * Reads the records of one run through a buffer.
+     */
+    struct run_reader
+    {
+        run_reader(const std::string& filename)
+            : input{filename, std::ios::binary},
+              buffer(record_size * 65536)
+        {
+            if (!input)
+                throw std::runtime_error{"failed to open " + filename};
+        }
+
+        bool next()
+        {
+            if (pos == end)
+            {
+                input.read(buffer.data(),
+                           static_cast<std::streamsize>(buffer.size()));
+                pos = 0;
+                end = static_cast<std::size_t>(input.gcount());
+                if (end < record_size)
+                    return false;
+            }
+
+            std::memcpy(&user, &buffer[pos], 4);
+            std::memcpy(&time, &buffer[pos + 4], 4);
+            std::memcpy(&type, &buffer[pos + 8], 1);
+            pos += record_size;
+            return true;
+        }
+
+        uint64_t key() const
+        {
+            return uint64_t{user} << 32 | time;
+        }
+
+        std::ifstream input;
+        std::vector<char> buffer;
+        std::size_t pos = 0;
+        std::size_t end = 0;
+
+        uint32_t user = 0;
+        uint32_t time = 0;
+        action_type type = action_type::INIT;
+    };
+
+    std::string prefix_;
+    std::vector<std::string> runs_;
+    uint64_t num_actions_ = 0;
+};
+
+inline void action_log::spill()
+{
+    if (size() == 0)
+        return;
+
+    sort(*pool_);
+    runs_->write(*this);
+    users_ = {};
+    times_ = {};
+    types_ = {};
+}
+
+#endif
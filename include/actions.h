@@ -9,6 +9,10 @@
 #ifndef STACKEXCHANGE_ACTIONS_H_
 #define STACKEXCHANGE_ACTIONS_H_
 
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
 #include "meta/meta.h"
 #include "meta/sequence/markov_model.h"
 #include "meta/util/optional.h"
@@ -99,64 +103,27 @@ enum class content_type : uint8_t
     OTHER_ANSWER
 };
 
-template <class PostMap>
-meta::util::optional<content_type> content(post_id post, user_id user,
-                                           PostMap& post_map)
+/**
+ * @return a user id in 32 bits. The Community user's id of -1 comes back
+ * from parse_u64 wrapped around, and becomes UINT32_MAX (so it still sorts
+ * after everyone else).
+ */
+inline uint32_t compact_user_id(user_id user)
 {
-    auto it = post_map.find(post);
-    if (it == post_map.end())
-        return meta::util::nullopt;
-
-    if (it->value().op == user)
-    {
-        return it->value().parent ? content_type::MY_ANSWER
-                                  : content_type::MY_QUESTION;
-    }
-    else
-    {
-        return it->value().parent ? content_type::OTHER_ANSWER
-                                  : content_type::OTHER_QUESTION;
-    }
+    auto id = static_cast<int64_t>(static_cast<uint64_t>(user));
+    if (id < -1 || id >= std::numeric_limits<uint32_t>::max())
+        throw std::out_of_range{"user id does not fit in 32 bits"};
+    return static_cast<uint32_t>(id);
 }
 
-template <class PostMap>
-meta::util::optional<action_type> comment_type(post_id post, user_id user,
-                                               PostMap& post_map)
+/**
+ * @return the user id a compact_user_id() came from
+ */
+inline user_id expand_user_id(uint32_t id)
 {
-    auto parent_type = content(post, user, post_map);
-    if (!parent_type)
-        return meta::util::nullopt;
-
-    switch (*parent_type)
-    {
-        case content_type::MY_QUESTION:
-            return action_type::COMMENT_MQ;
-        case content_type::OTHER_QUESTION:
-            return action_type::COMMENT_OQ;
-        case content_type::MY_ANSWER:
-        case content_type::OTHER_ANSWER:
-            // comment was on an answer. Was the question our own?
-            {
-                auto qtype = content(*post_map.at(post).parent, user, post_map);
-                if (!qtype)
-                    return meta::util::nullopt;
-
-                if (*qtype == content_type::MY_QUESTION)
-                {
-                    return *parent_type == content_type::MY_ANSWER
-                               ? action_type::COMMENT_MA_MQ
-                               : action_type::COMMENT_OA_MQ;
-                }
-                else
-                {
-                    return *parent_type == content_type::MY_ANSWER
-                               ? action_type::COMMENT_MA_OQ
-                               : action_type::COMMENT_OA_OQ;
-                }
-            }
-        default:
-            return meta::util::nullopt;
-    }
+    if (id == std::numeric_limits<uint32_t>::max())
+        return user_id{static_cast<uint64_t>(-1)};
+    return user_id{id};
 }
 
 inline action_type action_cast(history_type_id id, content_type type)
@@ -0,0 +1,168 @@
+/**
+ * @file archive_file.h
+ * @author Chase Geigle
+ *
+ * Thin RAII wrappers around libarchive for reading the original .7z data
+ * dump archives.
+ */
+
+#ifndef STACKEXCHANGE_ARCHIVE_FILE_H_
+#define STACKEXCHANGE_ARCHIVE_FILE_H_
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <stdexcept>
+#include <string>
+
+#include "input.h"
+#include "progress_report.h"
+
+class archive_ptr
+{
+  public:
+    archive_ptr() : a_{archive_read_new()}
+    {
+        if (!a_)
+            throw std::runtime_error{"failed to construct archive"};
+    }
+
+    archive_ptr(const archive_ptr&) = delete;
+    archive_ptr& operator=(const archive_ptr&) = delete;
+
+    operator archive*()
+    {
+        return a_;
+    }
+
+    ~archive_ptr()
+    {
+        archive_read_free(a_);
+    }
+
+  private:
+    archive* a_;
+};
+
+struct archive_file
+{
+  public:
+    archive_file(const char* filename)
+    {
+        archive_read_support_format_all(a_);
+        archive_read_support_filter_all(a_);
+
+        if (archive_read_open_filename(a_, filename, 10240))
+        {
+            throw std::runtime_error{"failed to open file: "
+                                     + std::string{filename}};
+        }
+    }
+
+    ~archive_file()
+    {
+        archive_read_close(a_);
+    }
+
+    operator archive*()
+    {
+        return a_;
+    }
+
+    /**
+     * Advances to the next entry in the archive.
+     * @return the entry, or nullptr at the end of the archive
+     */
+    archive_entry* next_entry()
+    {
+        archive_entry* entry;
+        int res = archive_read_next_header(a_, &entry);
+        if (res == ARCHIVE_EOF)
+            return nullptr;
+
+        if (res != ARCHIVE_OK)
+            throw std::runtime_error{std::string{"error reading archive: "}
+                                     + archive_error_string(a_)};
+        return entry;
+    }
+
+    /**
+     * Advances to the entry with the given path. Entries before it are
+     * skipped without being decompressed where the format allows it.
+     * @return the entry, or nullptr if the archive has no such entry
+     */
+    archive_entry* find_entry(const std::string& path)
+    {
+        while (auto entry = next_entry())
+        {
+            if (path == archive_entry_pathname(entry))
+                return entry;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Reads up to len bytes of the current entry's data into buffer.
+     * @return the number of bytes read, or 0 at the end of the entry
+     */
+    std::size_t read_data(char* buffer, std::size_t len)
+    {
+        auto res = archive_read_data(a_, buffer, len);
+        if (res < 0)
+            throw std::runtime_error{std::string{"failed to extract file: "}
+                                     + archive_error_string(a_)};
+        return static_cast<std::size_t>(res);
+    }
+
+    /**
+     * @return the number of bytes of the archive file read so far
+     */
+    uint64_t bytes_read()
+    {
+        return static_cast<uint64_t>(archive_filter_bytes(a_, -1));
+    }
+
+  private:
+    archive_ptr a_;
+};
+
+/**
+ * Streams a single entry (e.g. "Posts.xml") straight out of an archive,
+ * reporting the number of uncompressed bytes read so far to a progress
+ * object.
+ */
+class archive_source : public input_source
+{
+  public:
+    archive_source(const std::string& filename, const std::string& entry,
+                   progress_report progress)
+        : file_{filename.c_str()}, progress_(progress)
+    {
+        if (!file_.find_entry(entry))
+            throw std::runtime_error{"no entry " + entry + " in "
+                                     + filename};
+    }
+
+    std::size_t read(char* buffer, std::size_t len) override
+    {
+        // archive_read_data may return short reads at internal block
+        // boundaries, so keep going until the buffer is full
+        std::size_t total = 0;
+        while (total < len)
+        {
+            auto num_read = file_.read_data(buffer + total, len - total);
+            if (num_read == 0)
+                break;
+            total += num_read;
+        }
+        bytes_read_ += total;
+        progress_(bytes_read_);
+        return total;
+    }
+
+  private:
+    archive_file file_;
+    progress_report progress_;
+    uint64_t bytes_read_ = 0;
+};
+
+#endif
@@ -0,0 +1,238 @@
+/**
+ * @file block_index.h
+ * @author Chase Geigle
+ *
+ * A sidecar index over the blocks of a repacked table, used to read only
+ * the parts of the table that can contain rows in a given Id or
+ * CreationDate range.
+ */
+
+#ifndef STACKEXCHANGE_BLOCK_INDEX_H_
+#define STACKEXCHANGE_BLOCK_INDEX_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "input.h"
+#include "parsing.h"
+
+#include "meta/io/packed.h"
+#include "meta/util/optional.h"
+
+/**
+ * A window of rows by Id and/or CreationDate. Unset bounds are open; set
+ * ones are inclusive.
+ */
+struct row_range
+{
+    meta::util::optional<uint64_t> min_id;
+    meta::util::optional<uint64_t> max_id;
+    meta::util::optional<sys_milliseconds> min_date;
+    meta::util::optional<sys_milliseconds> max_date;
+
+    bool contains_id(uint64_t id) const
+    {
+        return (!min_id || id >= *min_id) && (!max_id || id <= *max_id);
+    }
+
+    bool contains_date(sys_milliseconds date) const
+    {
+        return (!min_date || date >= *min_date)
+               && (!max_date || date <= *max_date);
+    }
+};
+
+/**
+ * Summarizes the rows of a table in fixed-size blocks of its uncompressed
+ * bytes (the same blocks repack compresses independently). A row belongs
+ * to the block it starts in.
+ *
+ * The index is written next to the table as e.g. "Posts.xml.xz.idx".
+ */
+class block_index
+{
+  public:
+    struct block
+    {
+        /// the offset of the first row starting in this block, or of the
+        /// next row after it if none do
+        uint64_t row_offset = 0;
+        uint64_t num_rows = 0;
+        uint64_t first_id = 0;
+        uint64_t last_id = 0;
+        int64_t min_date = std::numeric_limits<int64_t>::max();
+        int64_t max_date = std::numeric_limits<int64_t>::min();
+    };
+
+    block_index(uint64_t block_size = 24 * 1024 * 1024)
+        : block_size_{block_size}
+    {
+        // nothing
+    }
+
+    /**
+     * Records a row starting at the given uncompressed offset. Rows must
+     * be added in file order.
+     */
+    void add_row(uint64_t offset,
+                 const meta::util::optional<uint64_t>& id,
+                 const meta::util::optional<sys_milliseconds>& date)
+    {
+        auto idx = offset / block_size_;
+        while (blocks_.size() <= idx)
+        {
+            blocks_.emplace_back();
+            blocks_.back().row_offset = offset;
+        }
+
+        auto& blk = blocks_[idx];
+        if (blk.num_rows == 0)
+            blk.row_offset = offset;
+        ++blk.num_rows;
+
+        if (id)
+        {
+            if (blk.num_rows == 1)
+                blk.first_id = *id;
+            blk.last_id = *id;
+        }
+
+        if (date)
+        {
+            auto ms = static_cast<int64_t>(date->time_since_epoch().count());
+            blk.min_date = std::min(blk.min_date, ms);
+            blk.max_date = std::max(blk.max_date, ms);
+        }
+    }
+
+    /**
+     * Completes the index once the whole table (of total_size bytes) has
+     * been seen.
+     */
+    void finish(uint64_t total_size)
+    {
+        total_size_ = total_size;
+        auto num_blocks = (total_size + block_size_ - 1) / block_size_;
+        while (blocks_.size() < num_blocks)
+        {
+            blocks_.emplace_back();
+            blocks_.back().row_offset = total_size;
+        }
+    }
+
+    void save(const std::string& filename) const
+    {
+        std::ofstream output{filename, std::ios::binary};
+        meta::io::packed::write(output, block_size_);
+        meta::io::packed::write(output, total_size_);
+        meta::io::packed::write(output, blocks_.size());
+        for (const auto& blk : blocks_)
+        {
+            meta::io::packed::write(output, blk.row_offset);
+            meta::io::packed::write(output, blk.num_rows);
+            meta::io::packed::write(output, blk.first_id);
+            meta::io::packed::write(output, blk.last_id);
+            meta::io::packed::write(output, blk.min_date);
+            meta::io::packed::write(output, blk.max_date);
+        }
+        if (!output)
+            throw std::runtime_error{"failed to write index " + filename};
+    }
+
+    static block_index load(const std::string& filename)
+    {
+        std::ifstream input{filename, std::ios::binary};
+        if (!input)
+            throw std::runtime_error{"failed to open index " + filename};
+
+        block_index index;
+        uint64_t num_blocks;
+        meta::io::packed::read(input, index.block_size_);
+        meta::io::packed::read(input, index.total_size_);
+        meta::io::packed::read(input, num_blocks);
+        index.blocks_.resize(num_blocks);
+        for (auto& blk : index.blocks_)
+        {
+            meta::io::packed::read(input, blk.row_offset);
+            meta::io::packed::read(input, blk.num_rows);
+            meta::io::packed::read(input, blk.first_id);
+            meta::io::packed::read(input, blk.last_id);
+            meta::io::packed::read(input, blk.min_date);
+            meta::io::packed::read(input, blk.max_date);
+        }
+        if (!input)
+            throw std::runtime_error{"truncated index " + filename};
+        return index;
+    }
+
+    /**
+     * @return the uncompressed byte ranges, in file order, holding every
+     * row of the blocks that may contain rows in range. Each range starts
+     * at a row and ends just before one (or at the end of the table), so
+     * the rows in them can be scanned back to back.
+     */
+    std::vector<byte_range> select(const row_range& range) const
+    {
+        std::vector<byte_range> ranges;
+        for (std::size_t i = 0; i < blocks_.size(); ++i)
+        {
+            const auto& blk = blocks_[i];
+            if (blk.num_rows == 0 || !overlaps(blk, range))
+                continue;
+
+            auto last = i + 1 < blocks_.size() ? blocks_[i + 1].row_offset
+                                               : total_size_;
+            if (!ranges.empty() && ranges.back().last == blk.row_offset)
+                ranges.back().last = last;
+            else
+                ranges.push_back({blk.row_offset, last});
+        }
+        return ranges;
+    }
+
+    uint64_t block_size() const
+    {
+        return block_size_;
+    }
+
+    const std::vector<block>& blocks() const
+    {
+        return blocks_;
+    }
+
+  private:
+    static bool overlaps(const block& blk, const row_range& range)
+    {
+        // ids increase through a table, so [first_id, last_id] bounds the
+        // block; blocks without dates never match a date range
+        if (range.min_id && blk.last_id < *range.min_id)
+            return false;
+        if (range.max_id && blk.first_id > *range.max_id)
+            return false;
+        if (range.min_date
+            && blk.max_date < range.min_date->time_since_epoch().count())
+            return false;
+        if (range.max_date
+            && blk.min_date > range.max_date->time_since_epoch().count())
+            return false;
+        return true;
+    }
+
+    uint64_t block_size_;
+    uint64_t total_size_ = 0;
+    std::vector<block> blocks_;
+};
+
+/**
+ * @return the path of the block index repack writes next to a table file
+ */
+inline std::string index_filename(const std::string& filename)
+{
+    return filename + ".idx";
+}
+
+#endif
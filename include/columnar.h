@@ -0,0 +1,465 @@
+/**
+ * @file columnar.h
+ * @author Chase Geigle
+ *
+ * A typed, fixed-width column layout for the tables the extractors read,
+ * written by `repack --columnar` and read back through memory mappings.
+ *
+ * Each table is stored in a folder (e.g. "Posts.columns") holding one
+ * file per attribute of its schema (see find_schema()):
+ *
+ * - ids are int32_t (".i32"), with INT32_MIN marking a missing value
+ * - *TypeId attributes are uint8_t (".u8"), with 0xFF marking a missing
+ *   value
+ * - CreationDate is int64_t milliseconds since the epoch (".i64"), with
+ *   INT64_MIN marking a missing value
+ * - Tags are dictionary encoded: "Tags.dict" gives the delimiters the
+ *   dump wrote them with ("<>" for "<c++><templates>", "|" for
+ *   "|c++|templates|") on its first line and then the distinct tags one
+ *   per line, "Tags.ids" holds the uint32_t indices among those of each
+ *   row's tags back to back, and "Tags.offsets" the uint64_t index into
+ *   Tags.ids at which each row's tags start, plus one final entry. A row
+ *   with an empty range has no Tags attribute.
+ *
+ * All values are in host byte order.
+ */
+
+#ifndef STACKEXCHANGE_COLUMNAR_H_
+#define STACKEXCHANGE_COLUMNAR_H_
+
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "date.h"
+#include "parsing.h"
+#include "progress_report.h"
+
+#include "meta/io/filesystem.h"
+#include "meta/io/mmap_file.h"
+#include "meta/meta.h"
+
+enum class column_type
+{
+    ID,
+    ENUM,
+    TIMESTAMP,
+    TAGS
+};
+
+/**
+ * @return the storage type of the attribute with the given name
+ */
+inline column_type column_type_of(meta::util::string_view name)
+{
+    if (name == "Tags")
+        return column_type::TAGS;
+    if (name == "CreationDate")
+        return column_type::TIMESTAMP;
+    if (name.size() > 6 && name.substr(name.size() - 6) == "TypeId")
+        return column_type::ENUM;
+    return column_type::ID;
+}
+
+/**
+ * @return the folder holding the columns of the named table (e.g. "Posts")
+ * in a repacked community folder
+ */
+inline std::string column_folder(const std::string& folder,
+                                 const std::string& table)
+{
+    return folder + "/" + table + ".columns";
+}
+
+/**
+ * @return the path of the column file for the named attribute; for Tags,
+ * this is the offsets file
+ */
+inline std::string column_filename(const std::string& folder,
+                                   meta::util::string_view name)
+{
+    auto path = folder + "/" + name.to_string();
+    switch (column_type_of(name))
+    {
+        case column_type::ID:
+            return path + ".i32";
+        case column_type::ENUM:
+            return path + ".u8";
+        case column_type::TIMESTAMP:
+            return path + ".i64";
+        case column_type::TAGS:
+            return path + ".offsets";
+    }
+    return path;
+}
+
+namespace detail
+{
+constexpr int32_t missing_id = std::numeric_limits<int32_t>::min();
+constexpr uint8_t missing_enum = 0xFF;
+constexpr int64_t missing_timestamp = std::numeric_limits<int64_t>::min();
+}
+
+/**
+ * Writes the rows of one table as columns.
+ */
+class column_writer
+{
+  public:
+    column_writer(const std::string& folder, const attribute_schema& schema)
+        : folder_{folder}, schema_(schema)
+    {
+        meta::filesystem::make_directories(folder_);
+        for (std::size_t i = 0; i < schema_.size(); ++i)
+        {
+            outputs_.emplace_back(column_filename(folder_, schema_.name(i)),
+                                  std::ios::binary);
+            if (!outputs_.back())
+                throw std::runtime_error{"failed to open column file in "
+                                         + folder_};
+
+            if (column_type_of(schema_.name(i)) == column_type::TAGS)
+            {
+                tag_ids_.open(folder_ + "/" + schema_.name(i).to_string()
+                                  + ".ids",
+                              std::ios::binary);
+                write(outputs_.back(), num_tags_);
+            }
+        }
+    }
+
+    /**
+     * Appends the current row of a reader over the same schema.
+     */
+    void append(const row_reader& row)
+    {
+        for (std::size_t i = 0; i < schema_.size(); ++i)
+        {
+            auto& output = outputs_[i];
+            switch (column_type_of(schema_.name(i)))
+            {
+                case column_type::ID:
+                    write(output, to_id(row.as_u64(i)));
+                    break;
+
+                case column_type::ENUM:
+                {
+                    auto value = row.as_u64(i);
+                    if (value && *value >= detail::missing_enum)
+                        throw std::runtime_error{"enum value out of range"};
+                    write(output, value ? static_cast<uint8_t>(*value)
+                                        : detail::missing_enum);
+                    break;
+                }
+
+                case column_type::TIMESTAMP:
+                {
+                    auto value = row.as_timestamp(i);
+                    write(output,
+                          value ? static_cast<int64_t>(
+                                      value->time_since_epoch().count())
+                                : detail::missing_timestamp);
+                    break;
+                }
+
+                case column_type::TAGS:
+                    if (auto value = row.as_view(i))
+                        append_tags(*value);
+                    write(output, num_tags_);
+                    break;
+            }
+        }
+    }
+
+    /**
+     * Flushes every column and writes out the tag dictionary.
+     */
+    void close()
+    {
+        for (auto& output : outputs_)
+            output.close();
+        if (!tag_ids_.is_open())
+            return;
+        tag_ids_.close();
+
+        // a table without any tags has no delimiters of its own
+        std::ofstream dict{folder_ + "/Tags.dict"};
+        dict << (tag_delimiters_.empty() ? "<>" : tag_delimiters_) << '\n';
+        for (const auto& name : tag_names_)
+            dict << name << '\n';
+    }
+
+  private:
+    template <class T>
+    static void write(std::ofstream& output, T value)
+    {
+        output.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static int32_t to_id(const meta::util::optional<uint64_t>& value)
+    {
+        if (!value)
+            return detail::missing_id;
+
+        // negative ids (the Community user) come back from parse_u64
+        // wrapped around
+        auto id = static_cast<int64_t>(*value);
+        if (id <= detail::missing_id
+            || id > std::numeric_limits<int32_t>::max())
+            throw std::runtime_error{"id out of range for a 32-bit column"};
+        return static_cast<int32_t>(id);
+    }
+
+    void append_tags(meta::util::string_view value)
+    {
+        // Tags look like "<c++><templates>" once unescaped (or
+        // "|c++|templates|" in newer dumps)
+        xml_unescape(value, tags_);
+        if (!tags_.empty())
+        {
+            auto delimiters = tags_[0] == '|' ? "|" : "<>";
+            if (tag_delimiters_.empty())
+                tag_delimiters_ = delimiters;
+            else if (tag_delimiters_ != delimiters)
+                throw std::runtime_error{"mixed Tags delimiters in "
+                                         + folder_};
+        }
+
+        std::size_t pos = 0;
+        while (pos < tags_.size())
+        {
+            auto end = tags_.find_first_of("<>|", pos);
+            if (end == std::string::npos)
+                end = tags_.size();
+
+            if (end > pos)
+            {
+                auto name = tags_.substr(pos, end - pos);
+                auto it = tag_dict_.find(name);
+                if (it == tag_dict_.end())
+                {
+                    auto id = static_cast<uint32_t>(tag_names_.size());
+                    it = tag_dict_.emplace(name, id).first;
+                    tag_names_.push_back(name);
+                }
+                write(tag_ids_, it->second);
+                ++num_tags_;
+            }
+            pos = end + 1;
+        }
+    }
+
+    std::string folder_;
+    const attribute_schema& schema_;
+    std::vector<std::ofstream> outputs_;
+
+    std::ofstream tag_ids_;
+    uint64_t num_tags_ = 0;
+    std::unordered_map<std::string, uint32_t> tag_dict_;
+    std::vector<std::string> tag_names_;
+    std::string tag_delimiters_;
+    std::string tags_;
+};
+
+/**
+ * Reads the projected columns of a table through memory mappings. Values
+ * are read straight out of the mappings; as_view() formats them back into
+ * their XML attribute form.
+ */
+class column_reader : public row_reader
+{
+  public:
+    column_reader(const std::string& folder, const attribute_schema& schema,
+                  progress_report progress)
+        : progress_(progress), columns_(schema.size()), text_(schema.size())
+    {
+        for (std::size_t i = 0; i < schema.size(); ++i)
+        {
+            auto& col = columns_[i];
+            col.type = column_type_of(schema.name(i));
+            if (!schema.is_projected(i))
+                continue;
+
+            col.values = map(column_filename(folder, schema.name(i)));
+            if (col.type == column_type::TAGS)
+            {
+                auto name = folder + "/" + schema.name(i).to_string();
+                col.tag_ids = map(name + ".ids");
+                std::ifstream dict{name + ".dict"};
+                std::string tag;
+                if (!std::getline(dict, tag) || (tag != "<>" && tag != "|"))
+                    throw std::runtime_error{"missing Tags delimiters in "
+                                             + name + ".dict"};
+                pipe_tags_ = tag == "|";
+                while (std::getline(dict, tag))
+                    tag_names_.push_back(tag);
+            }
+        }
+
+        auto ids = map(column_filename(folder, "Id"));
+        num_rows_ = ids ? ids->size() / sizeof(int32_t) : 0;
+    }
+
+    /**
+     * @return the number of rows in the table
+     */
+    uint64_t size() const
+    {
+        return num_rows_;
+    }
+
+    bool read_next() override
+    {
+        if (next_ == num_rows_)
+        {
+            progress_(num_rows_);
+            return false;
+        }
+
+        row_ = next_++;
+        if (row_ % 65536 == 0)
+            progress_(row_);
+        return true;
+    }
+
+    meta::util::optional<meta::util::string_view>
+    as_view(std::size_t field) const override
+    {
+        const auto& col = columns_[field];
+        auto& text = text_[field];
+        if (col.type == column_type::TIMESTAMP)
+        {
+            auto value = as_timestamp(field);
+            if (!value)
+                return meta::util::nullopt;
+            text = date::format("%FT%T", *value);
+        }
+        else if (col.type == column_type::TAGS)
+        {
+            if (!col.values)
+                return meta::util::nullopt;
+
+            auto offsets = values<uint64_t>(col);
+            if (offsets[row_] == offsets[row_ + 1])
+                return meta::util::nullopt;
+
+            // re-escaped with the dump's own delimiters, since
+            // row_scanner returns Tags undecoded
+            text.clear();
+            auto ids = values<uint32_t>(col.tag_ids);
+            for (auto i = offsets[row_]; i < offsets[row_ + 1]; ++i)
+            {
+                text += pipe_tags_ ? "|" : "&lt;";
+                for (auto c : tag_names_.at(ids[i]))
+                {
+                    if (c == '&')
+                        text += "&amp;";
+                    else
+                        text += c;
+                }
+                if (!pipe_tags_)
+                    text += "&gt;";
+            }
+            if (pipe_tags_)
+                text += "|";
+        }
+        else
+        {
+            auto value = as_u64(field);
+            if (!value)
+                return meta::util::nullopt;
+            if (col.type == column_type::ID)
+                text = std::to_string(static_cast<int64_t>(*value));
+            else
+                text = std::to_string(*value);
+        }
+        return meta::util::string_view{text};
+    }
+
+    meta::util::optional<uint64_t> as_u64(std::size_t field) const override
+    {
+        const auto& col = columns_[field];
+        if (!col.values)
+            return meta::util::nullopt;
+
+        if (col.type == column_type::ID)
+        {
+            auto value = values<int32_t>(col)[row_];
+            if (value == detail::missing_id)
+                return meta::util::nullopt;
+            return static_cast<uint64_t>(static_cast<int64_t>(value));
+        }
+
+        if (col.type == column_type::ENUM)
+        {
+            auto value = values<uint8_t>(col)[row_];
+            if (value == detail::missing_enum)
+                return meta::util::nullopt;
+            return static_cast<uint64_t>(value);
+        }
+
+        throw std::runtime_error{"not an integer column"};
+    }
+
+    meta::util::optional<sys_milliseconds>
+    as_timestamp(std::size_t field) const override
+    {
+        const auto& col = columns_[field];
+        if (!col.values)
+            return meta::util::nullopt;
+        if (col.type != column_type::TIMESTAMP)
+            throw std::runtime_error{"not a timestamp column"};
+
+        auto value = values<int64_t>(col)[row_];
+        if (value == detail::missing_timestamp)
+            return meta::util::nullopt;
+        return sys_milliseconds{std::chrono::milliseconds{value}};
+    }
+
+  private:
+    struct column
+    {
+        column_type type;
+        /// null if the field is not projected (or has no values at all)
+        std::unique_ptr<meta::io::mmap_file> values;
+        std::unique_ptr<meta::io::mmap_file> tag_ids;
+    };
+
+    static std::unique_ptr<meta::io::mmap_file> map(const std::string& path)
+    {
+        if (!meta::filesystem::file_exists(path))
+            throw std::runtime_error{"missing column file: " + path};
+        // an empty file cannot be mapped
+        if (meta::filesystem::file_size(path) == 0)
+            return nullptr;
+        return meta::make_unique<meta::io::mmap_file>(path);
+    }
+
+    template <class T>
+    static const T* values(const std::unique_ptr<meta::io::mmap_file>& file)
+    {
+        return reinterpret_cast<const T*>(file->begin());
+    }
+
+    template <class T>
+    static const T* values(const column& col)
+    {
+        return values<T>(col.values);
+    }
+
+    progress_report progress_;
+    std::vector<column> columns_;
+    std::vector<std::string> tag_names_;
+    /// whether Tags are written back as "|c++|templates|"
+    bool pipe_tags_ = false;
+    mutable std::vector<std::string> text_;
+    uint64_t num_rows_ = 0;
+    uint64_t next_ = 0;
+    uint64_t row_ = 0;
+};
+
+#endif
@@ -0,0 +1,725 @@
+/**
+ * @file input.h
+ * @author Chase Geigle
+ *
+ * Sources of decompressed bytes for the row scanner.
+ */
+
+#ifndef STACKEXCHANGE_INPUT_H_
+#define STACKEXCHANGE_INPUT_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lzma.h>
+#ifdef STACKEXCHANGE_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+#include "meta/io/mmap_file.h"
+#include "meta/io/xzstream.h"
+#include "meta/meta.h"
+#include "meta/parallel/thread_pool.h"
+
+#include "progress_report.h"
+
+/**
+ * A stream of decompressed table bytes.
+ */
+class input_source
+{
+  public:
+    virtual ~input_source() = default;
+
+    /**
+     * Reads up to len bytes into buffer.
+     * @return the number of bytes read, which is only ever 0 once the
+     * input is exhausted
+     */
+    virtual std::size_t read(char* buffer, std::size_t len) = 0;
+};
+
+/**
+ * A half-open range [first, last) of decompressed bytes in a table.
+ */
+struct byte_range
+{
+    uint64_t first;
+    uint64_t last;
+};
+
+/**
+ * Passes along only the bytes of another source that fall within a set
+ * of sorted, disjoint ranges. Everything else is still decompressed, but
+ * discarded; sources that can seek take the ranges directly instead.
+ */
+class range_source : public input_source
+{
+  public:
+    range_source(std::unique_ptr<input_source> source,
+                 std::vector<byte_range> ranges)
+        : source_{std::move(source)}, ranges_(std::move(ranges))
+    {
+        // nothing
+    }
+
+    std::size_t read(char* buffer, std::size_t len) override
+    {
+        while (range_ < ranges_.size())
+        {
+            const auto& range = ranges_[range_];
+            if (pos_ >= range.last)
+            {
+                ++range_;
+                continue;
+            }
+
+            if (pos_ < range.first)
+            {
+                // read (and drop) the gap straight into the caller's buffer
+                auto num_read = source_->read(
+                    buffer, std::min<uint64_t>(len, range.first - pos_));
+                if (num_read == 0)
+                    return 0;
+                pos_ += num_read;
+                continue;
+            }
+
+            auto num_read = source_->read(
+                buffer, std::min<uint64_t>(len, range.last - pos_));
+            pos_ += num_read;
+            return num_read;
+        }
+        return 0;
+    }
+
+  private:
+    std::unique_ptr<input_source> source_;
+    std::vector<byte_range> ranges_;
+    std::size_t range_ = 0;
+    uint64_t pos_ = 0;
+};
+
+/**
+ * Reads synchronously from an xz compressed file, reporting the number of
+ * compressed bytes consumed so far to a progress object.
+ */
+class xz_source : public input_source
+{
+  public:
+    xz_source(const std::string& filename, progress_report progress)
+        : input_{filename}, progress_(progress)
+    {
+        // nothing
+    }
+
+    std::size_t read(char* buffer, std::size_t len) override
+    {
+        input_.read(buffer, static_cast<std::streamsize>(len));
+        auto num_read = static_cast<std::size_t>(input_.gcount());
+        progress_(input_.bytes_read());
+        return num_read;
+    }
+
+  private:
+    meta::io::xzifstream input_;
+    progress_report progress_;
+};
+
+/**
+ * Decodes an xz file made of several independently compressed blocks (as
+ * written by `xz -T` or `xz --block-size`) on a thread pool. The block
+ * offsets come from the index at the end of the file; blocks are decoded
+ * concurrently but handed back in file order. Without a pool, blocks are
+ * decoded on the reading thread. Progress is reported in bytes of the
+ * file on disk.
+ *
+ * Given a set of sorted, disjoint byte ranges, only the blocks that
+ * overlap them are decoded, and only the bytes within them are returned.
+ *
+ * Only single-stream files can be decoded this way. Check num_blocks()
+ * after construction: if it is 0 the file must be read with xz_source.
+ */
+class xz_block_source : public input_source
+{
+  public:
+    xz_block_source(const std::string& filename,
+                    progress_report progress,
+                    meta::parallel::thread_pool* pool,
+                    const std::vector<byte_range>* ranges = nullptr)
+        : file_{filename}, progress_(progress), pool_(pool)
+    {
+        read_index();
+        num_blocks_ = blocks_.size();
+        if (ranges)
+            select(*ranges);
+    }
+
+    ~xz_block_source()
+    {
+        // blocks still being decoded refer to the mapping
+        for (auto& fut : pending_)
+            fut.wait();
+    }
+
+    /**
+     * @return the number of blocks in the file, or 0 if it is not a
+     * single xz stream with a readable index
+     */
+    std::size_t num_blocks() const
+    {
+        return num_blocks_;
+    }
+
+    std::size_t read(char* buffer, std::size_t len) override
+    {
+        while (pos_ == current_.size())
+        {
+            if (!next_block())
+                return 0;
+        }
+
+        auto num_read = std::min(len, current_.size() - pos_);
+        std::memcpy(buffer, current_.data() + pos_, num_read);
+        pos_ += num_read;
+        return num_read;
+    }
+
+  private:
+    struct block_info
+    {
+        uint64_t offset;
+        uint64_t total_size;
+        uint64_t uncompressed_offset;
+        uint64_t uncompressed_size;
+        /// the part of the block to return, relative to its start
+        uint64_t first;
+        uint64_t last;
+    };
+
+    const uint8_t* data() const
+    {
+        return reinterpret_cast<const uint8_t*>(file_.begin());
+    }
+
+    void read_index()
+    {
+        uint64_t size = file_.size();
+        if (size < 2 * LZMA_STREAM_HEADER_SIZE)
+            return;
+
+        // stream padding is a multiple of four null bytes
+        while (size >= 2 * LZMA_STREAM_HEADER_SIZE + 4
+               && std::all_of(data() + size - 4, data() + size,
+                              [](uint8_t b) { return b == 0; }))
+            size -= 4;
+
+        lzma_stream_flags header;
+        lzma_stream_flags footer;
+        auto footer_pos = size - LZMA_STREAM_HEADER_SIZE;
+        if (lzma_stream_header_decode(&header, data()) != LZMA_OK
+            || lzma_stream_footer_decode(&footer, data() + footer_pos)
+                   != LZMA_OK
+            || lzma_stream_flags_compare(&header, &footer) != LZMA_OK
+            || footer.backward_size > footer_pos)
+            return;
+
+        lzma_index* index = nullptr;
+        uint64_t memlimit = UINT64_MAX;
+        std::size_t in_pos = 0;
+        auto index_pos = footer_pos - footer.backward_size;
+        if (lzma_index_buffer_decode(&index, &memlimit, nullptr,
+                                     data() + index_pos, &in_pos,
+                                     footer.backward_size)
+            != LZMA_OK)
+            return;
+
+        // anything else (e.g. concatenated streams) goes through liblzma's
+        // regular stream decoder instead
+        if (lzma_index_stream_size(index) == size)
+        {
+            lzma_index_iter iter;
+            lzma_index_iter_init(&iter, index);
+            while (!lzma_index_iter_next(&iter,
+                                         LZMA_INDEX_ITER_NONEMPTY_BLOCK))
+            {
+                blocks_.push_back({iter.block.compressed_file_offset,
+                                   iter.block.total_size,
+                                   iter.block.uncompressed_file_offset,
+                                   iter.block.uncompressed_size, 0,
+                                   iter.block.uncompressed_size});
+            }
+            check_ = footer.check;
+        }
+        lzma_index_end(index, nullptr);
+    }
+
+    /**
+     * Replaces the blocks to decode with the parts of them that fall
+     * within ranges. A block overlapping several ranges is decoded once
+     * per range, which only happens for ranges closer than a block apart.
+     */
+    void select(const std::vector<byte_range>& ranges)
+    {
+        std::vector<block_info> selected;
+        auto blk = blocks_.begin();
+        for (const auto& range : ranges)
+        {
+            while (blk != blocks_.end()
+                   && blk->uncompressed_offset + blk->uncompressed_size
+                          <= range.first)
+                ++blk;
+
+            for (auto it = blk; it != blocks_.end()
+                                && it->uncompressed_offset < range.last;
+                 ++it)
+            {
+                auto info = *it;
+                info.first = std::max(range.first, it->uncompressed_offset)
+                             - it->uncompressed_offset;
+                info.last = std::min(range.last, it->uncompressed_offset
+                                                     + it->uncompressed_size)
+                            - it->uncompressed_offset;
+                selected.push_back(info);
+            }
+        }
+        blocks_ = std::move(selected);
+    }
+
+    std::vector<char> decode_block(const block_info& info) const
+    {
+        auto in = data() + info.offset;
+
+        lzma_filter filters[LZMA_FILTERS_MAX + 1];
+        lzma_block block{};
+        block.version = 0;
+        block.check = check_;
+        block.filters = filters;
+        block.header_size = lzma_block_header_size_decode(in[0]);
+        if (lzma_block_header_decode(&block, nullptr, in) != LZMA_OK)
+            throw std::runtime_error{"corrupt xz block header"};
+
+        std::vector<char> out(info.uncompressed_size);
+        std::size_t in_pos = block.header_size;
+        std::size_t out_pos = 0;
+        auto ret = lzma_block_buffer_decode(
+            &block, nullptr, in, &in_pos, info.total_size,
+            reinterpret_cast<uint8_t*>(&out[0]), &out_pos, out.size());
+
+        for (std::size_t i = 0; filters[i].id != LZMA_VLI_UNKNOWN; ++i)
+            std::free(filters[i].options);
+
+        if (ret != LZMA_OK || out_pos != out.size())
+            throw std::runtime_error{"failed to decode xz block"};
+
+        if (info.first > 0 || info.last < out.size())
+        {
+            out.erase(out.begin() + static_cast<std::ptrdiff_t>(info.last),
+                      out.end());
+            out.erase(out.begin(),
+                      out.begin() + static_cast<std::ptrdiff_t>(info.first));
+        }
+        return out;
+    }
+
+    /**
+     * Waits for the next block in file order, keeping the pool busy with
+     * the ones after it.
+     * @return false if every block has been consumed
+     */
+    bool next_block()
+    {
+        if (!pool_)
+        {
+            if (next_block_ == blocks_.size())
+                return false;
+            current_ = decode_block(blocks_[next_block_]);
+        }
+        else
+        {
+            while (next_submit_ < blocks_.size()
+                   && pending_.size() < 2 * pool_->size())
+            {
+                auto info = blocks_[next_submit_++];
+                pending_.push_back(pool_->submit_task(
+                    [this, info]() { return decode_block(info); }));
+            }
+
+            if (pending_.empty())
+                return false;
+
+            current_ = pending_.front().get();
+            pending_.pop_front();
+        }
+        pos_ = 0;
+
+        const auto& info = blocks_[next_block_++];
+        progress_(info.offset + info.total_size);
+        return true;
+    }
+
+    meta::io::mmap_file file_;
+    progress_report progress_;
+    meta::parallel::thread_pool* pool_;
+
+    std::vector<block_info> blocks_;
+    std::size_t num_blocks_ = 0;
+    lzma_check check_ = LZMA_CHECK_NONE;
+
+    std::size_t next_submit_ = 0;
+    std::size_t next_block_ = 0;
+    std::deque<std::future<std::vector<char>>> pending_;
+    std::vector<char> current_;
+    std::size_t pos_ = 0;
+};
+
+#ifdef STACKEXCHANGE_HAS_ZSTD
+/**
+ * Reads synchronously from a zstd compressed file, reporting the number
+ * of compressed bytes consumed so far to a progress object.
+ */
+class zstd_source : public input_source
+{
+  public:
+    zstd_source(const std::string& filename,
+                progress_report progress)
+        : filename_{filename},
+          input_{filename, std::ios::binary},
+          progress_(progress),
+          stream_{ZSTD_createDStream()},
+          in_buffer_(ZSTD_DStreamInSize()),
+          in_{in_buffer_.data(), 0, 0}
+    {
+        if (!input_)
+            throw std::runtime_error{"failed to open " + filename};
+        if (!stream_)
+            throw std::runtime_error{"failed to create zstd stream"};
+        ZSTD_initDStream(stream_);
+    }
+
+    ~zstd_source()
+    {
+        ZSTD_freeDStream(stream_);
+    }
+
+    std::size_t read(char* buffer, std::size_t len) override
+    {
+        ZSTD_outBuffer out{buffer, len, 0};
+        while (out.pos < out.size)
+        {
+            auto exhausted = false;
+            if (in_.pos == in_.size)
+            {
+                input_.read(in_buffer_.data(),
+                            static_cast<std::streamsize>(in_buffer_.size()));
+                in_.size = static_cast<std::size_t>(input_.gcount());
+                in_.pos = 0;
+                bytes_read_ += in_.size;
+                progress_(bytes_read_);
+                exhausted = in_.size == 0;
+            }
+
+            auto old_pos = out.pos;
+            auto res = ZSTD_decompressStream(stream_, &out, &in_);
+            if (ZSTD_isError(res))
+                throw std::runtime_error{std::string{"zstd error: "}
+                                         + ZSTD_getErrorName(res)};
+
+            // no more input and nothing left buffered in the decoder
+            if (exhausted && out.pos == old_pos)
+            {
+                if (frame_remaining_ != 0)
+                    throw std::runtime_error{"truncated zstd table "
+                                             + filename_};
+                break;
+            }
+            frame_remaining_ = res;
+        }
+        return out.pos;
+    }
+
+  private:
+    std::string filename_;
+    std::ifstream input_;
+    progress_report progress_;
+    ZSTD_DStream* stream_;
+    std::vector<char> in_buffer_;
+    ZSTD_inBuffer in_;
+    uint64_t bytes_read_ = 0;
+    /// the last result of ZSTD_decompressStream, which is 0 only once a
+    /// frame has been completely decoded and flushed; the input ending
+    /// while it is not means the table was cut off part way into a frame
+    std::size_t frame_remaining_ = 0;
+};
+#endif
+
+/**
+ * Reads an uncompressed table straight out of a memory mapping, or only
+ * the given sorted, disjoint byte ranges of it.
+ */
+class mmap_source : public input_source
+{
+  public:
+    mmap_source(const std::string& filename,
+                progress_report progress,
+                const std::vector<byte_range>* ranges = nullptr)
+        : file_{filename}, progress_(progress)
+    {
+        if (ranges)
+            ranges_ = *ranges;
+        else
+            ranges_.push_back({0, file_.size()});
+    }
+
+    std::size_t read(char* buffer, std::size_t len) override
+    {
+        while (range_ < ranges_.size())
+        {
+            const auto& range = ranges_[range_];
+            pos_ = std::max(pos_, range.first);
+            auto last = std::min<uint64_t>(range.last, file_.size());
+            if (pos_ >= last)
+            {
+                ++range_;
+                continue;
+            }
+
+            auto num_read = std::min<uint64_t>(len, last - pos_);
+            std::memcpy(buffer, file_.begin() + pos_, num_read);
+            pos_ += num_read;
+            progress_(pos_);
+            return num_read;
+        }
+        return 0;
+    }
+
+  private:
+    meta::io::mmap_file file_;
+    progress_report progress_;
+    std::vector<byte_range> ranges_;
+    std::size_t range_ = 0;
+    uint64_t pos_ = 0;
+};
+
+/**
+ * The file extensions a repacked table may have, in order of preference
+ * when more than one is present: raw XML is memory mapped, and zstd
+ * decodes several times faster than xz.
+ */
+inline const std::vector<std::string>& table_extensions()
+{
+    static std::vector<std::string> extensions{
+        ".xml",
+#ifdef STACKEXCHANGE_HAS_ZSTD
+        ".xml.zst",
+#endif
+        ".xml.xz"};
+    return extensions;
+}
+
+inline bool ends_with(const std::string& str, const std::string& suffix)
+{
+    return str.size() >= suffix.size()
+           && str.compare(str.size() - suffix.size(), suffix.size(), suffix)
+                  == 0;
+}
+
+/**
+ * Opens a table file with the codec matching its extension. Progress is
+ * reported in bytes of the file on disk. If a pool is given, multi-block
+ * xz files are decoded on it. If ranges are given, only the bytes within
+ * them are read, skipping whatever the codec allows without decoding it.
+ */
+inline std::unique_ptr<input_source>
+open_input(const std::string& filename, progress_report progress,
+           meta::parallel::thread_pool* pool = nullptr,
+           const std::vector<byte_range>* ranges = nullptr)
+{
+    std::unique_ptr<input_source> source;
+    if (ends_with(filename, ".xz"))
+    {
+        if (pool || ranges)
+        {
+            auto blocks = meta::make_unique<xz_block_source>(filename, progress,
+                                                             pool, ranges);
+            // a single block is the whole file, which could be huge
+            if (blocks->num_blocks() > 1)
+                return blocks;
+        }
+        source = meta::make_unique<xz_source>(filename, progress);
+    }
+    else if (ends_with(filename, ".zst"))
+    {
+#ifdef STACKEXCHANGE_HAS_ZSTD
+        source = meta::make_unique<zstd_source>(filename, progress);
+#else
+        throw std::runtime_error{"zstd support was not compiled in: "
+                                 + filename};
+#endif
+    }
+    else
+    {
+        return meta::make_unique<mmap_source>(filename, progress, ranges);
+    }
+
+    if (ranges)
+        return meta::make_unique<range_source>(std::move(source), *ranges);
+    return source;
+}
+
+/**
+ * Drains another source on a dedicated thread into a bounded ring of
+ * large buffers, so that decompression of the next buffer overlaps with
+ * parsing of the current one. Any progress reporting done by the wrapped
+ * source therefore happens on the producer thread.
+ */
+class pipelined_source : public input_source
+{
+  public:
+    pipelined_source(input_source& source, std::size_t num_buffers = 4,
+                     std::size_t buffer_size = 8 * 1024 * 1024)
+        : source_(source), ring_(num_buffers)
+    {
+        for (auto& buf : ring_)
+            buf.data.resize(buffer_size);
+        producer_ = std::thread{[this]() { produce(); }};
+    }
+
+    ~pipelined_source()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            stop_ = true;
+        }
+        not_full_.notify_one();
+        producer_.join();
+    }
+
+    std::size_t read(char* buffer, std::size_t len) override
+    {
+        if (!current_ || pos_ == current_->size)
+        {
+            if (!next_buffer())
+                return 0;
+        }
+
+        auto num_read = std::min(len, current_->size - pos_);
+        std::memcpy(buffer, current_->data.data() + pos_, num_read);
+        pos_ += num_read;
+        return num_read;
+    }
+
+  private:
+    struct ring_buffer
+    {
+        std::vector<char> data;
+        std::size_t size = 0;
+    };
+
+    /**
+     * Hands the current buffer back to the producer and waits for the
+     * next full one.
+     * @return false if the input is exhausted
+     */
+    bool next_buffer()
+    {
+        std::unique_lock<std::mutex> lock{mutex_};
+        if (current_)
+        {
+            head_ = (head_ + 1) % ring_.size();
+            --count_;
+            current_ = nullptr;
+            not_full_.notify_one();
+        }
+
+        not_empty_.wait(lock, [&]() { return count_ > 0 || done_; });
+        if (error_)
+            std::rethrow_exception(error_);
+        if (count_ == 0)
+            return false;
+
+        current_ = &ring_[head_];
+        pos_ = 0;
+        return true;
+    }
+
+    void produce()
+    {
+        try
+        {
+            while (true)
+            {
+                ring_buffer* buf;
+                {
+                    std::unique_lock<std::mutex> lock{mutex_};
+                    not_full_.wait(
+                        lock, [&]() { return count_ < ring_.size() || stop_; });
+                    if (stop_)
+                        break;
+                    buf = &ring_[tail_];
+                }
+
+                // the slot at tail_ is not visible to the consumer until
+                // count_ is incremented, so it can be filled unlocked
+                buf->size = 0;
+                while (buf->size < buf->data.size())
+                {
+                    auto num_read = source_.read(buf->data.data() + buf->size,
+                                                 buf->data.size() - buf->size);
+                    if (num_read == 0)
+                        break;
+                    buf->size += num_read;
+                }
+
+                std::lock_guard<std::mutex> lock{mutex_};
+                if (buf->size == 0)
+                    break;
+                tail_ = (tail_ + 1) % ring_.size();
+                ++count_;
+                not_empty_.notify_one();
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            error_ = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock{mutex_};
+        done_ = true;
+        not_empty_.notify_one();
+    }
+
+    input_source& source_;
+    std::vector<ring_buffer> ring_;
+
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::size_t head_ = 0;
+    std::size_t tail_ = 0;
+    std::size_t count_ = 0;
+    bool done_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+
+    // consumer side only
+    ring_buffer* current_ = nullptr;
+    std::size_t pos_ = 0;
+
+    std::thread producer_;
+};
+
+#endif
@@ -0,0 +1,291 @@
+/**
+ * @file output.h
+ * @author Chase Geigle
+ *
+ * Compressed (or not) destinations for repacked tables.
+ */
+
+#ifndef STACKEXCHANGE_OUTPUT_H_
+#define STACKEXCHANGE_OUTPUT_H_
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lzma.h>
+#ifdef STACKEXCHANGE_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+#include "meta/meta.h"
+
+/**
+ * The codecs repack can write tables with.
+ */
+enum class codec
+{
+    XZ,
+    ZSTD,
+    NONE
+};
+
+inline codec parse_codec(const std::string& name)
+{
+    if (name == "xz")
+        return codec::XZ;
+    if (name == "zstd")
+    {
+#ifdef STACKEXCHANGE_HAS_ZSTD
+        return codec::ZSTD;
+#else
+        throw std::runtime_error{"zstd support was not compiled in"};
+#endif
+    }
+    if (name == "none")
+        return codec::NONE;
+    throw std::runtime_error{"unknown codec: " + name};
+}
+
+/**
+ * @return the extension appended to a table's name (e.g. "Posts.xml") for
+ * the given codec; find_table() looks for the same set
+ */
+inline std::string codec_extension(codec c)
+{
+    switch (c)
+    {
+        case codec::XZ:
+            return ".xz";
+        case codec::ZSTD:
+            return ".zst";
+        case codec::NONE:
+            return "";
+    }
+    return "";
+}
+
+/**
+ * Settings shared by the compressing sinks.
+ */
+struct output_options
+{
+    /// size of the independently compressed xz blocks, and of the blocks
+    /// a block_index summarizes; 24 MB (what liblzma picks at the default
+    /// preset) costs well under 1% in ratio
+    uint64_t block_size = 24 * 1024 * 1024;
+    /// number of encoder threads for a single output
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+/**
+ * A destination for the bytes of a repacked table.
+ */
+class output_sink
+{
+  public:
+    virtual ~output_sink() = default;
+
+    virtual void write(const char* buffer, std::size_t len) = 0;
+
+    /**
+     * Flushes any buffered output. No more writes may follow.
+     */
+    virtual void close() = 0;
+};
+
+/**
+ * Writes an xz stream with liblzma's multithreaded encoder. The input is
+ * cut into blocks of options.block_size bytes that are compressed
+ * concurrently and can later be decoded independently (see
+ * xz_block_source).
+ */
+class xz_sink : public output_sink
+{
+  public:
+    xz_sink(const std::string& filename, const output_options& options,
+            uint32_t preset = 6)
+        : output_{filename, std::ios::binary}, out_buffer_(1024 * 1024)
+    {
+        if (!output_)
+            throw std::runtime_error{"failed to open " + filename};
+
+        lzma_mt mt{};
+        mt.threads = options.threads;
+        mt.block_size = options.block_size;
+        mt.preset = preset;
+        mt.check = LZMA_CHECK_CRC64;
+        check(lzma_stream_encoder_mt(&stream_, &mt));
+    }
+
+    ~xz_sink()
+    {
+        lzma_end(&stream_);
+    }
+
+    void write(const char* buffer, std::size_t len) override
+    {
+        stream_.next_in = reinterpret_cast<const uint8_t*>(buffer);
+        stream_.avail_in = len;
+        while (stream_.avail_in > 0)
+            compress(LZMA_RUN);
+    }
+
+    void close() override
+    {
+        while (compress(LZMA_FINISH) != LZMA_STREAM_END)
+        {
+            // keep flushing
+        }
+        output_.close();
+    }
+
+  private:
+    lzma_ret compress(lzma_action action)
+    {
+        stream_.next_out = reinterpret_cast<uint8_t*>(&out_buffer_[0]);
+        stream_.avail_out = out_buffer_.size();
+        auto ret = lzma_code(&stream_, action);
+        if (ret != LZMA_STREAM_END)
+            check(ret);
+        output_.write(out_buffer_.data(),
+                      static_cast<std::streamsize>(out_buffer_.size()
+                                                   - stream_.avail_out));
+        return ret;
+    }
+
+    static void check(lzma_ret ret)
+    {
+        if (ret != LZMA_OK)
+            throw std::runtime_error{"xz error: "
+                                     + std::to_string(static_cast<int>(ret))};
+    }
+
+    std::ofstream output_;
+    lzma_stream stream_ = LZMA_STREAM_INIT;
+    std::vector<char> out_buffer_;
+};
+
+class raw_sink : public output_sink
+{
+  public:
+    raw_sink(const std::string& filename)
+        : output_{filename, std::ios::binary}
+    {
+        if (!output_)
+            throw std::runtime_error{"failed to open " + filename};
+    }
+
+    void write(const char* buffer, std::size_t len) override
+    {
+        output_.write(buffer, static_cast<std::streamsize>(len));
+    }
+
+    void close() override
+    {
+        output_.close();
+    }
+
+  private:
+    std::ofstream output_;
+};
+
+#ifdef STACKEXCHANGE_HAS_ZSTD
+/**
+ * Writes a zstd stream at a high compression level, using zstd's own
+ * worker threads when the library was built with them.
+ */
+class zstd_sink : public output_sink
+{
+  public:
+    zstd_sink(const std::string& filename, const output_options& options,
+              int level = 19)
+        : output_{filename, std::ios::binary},
+          stream_{ZSTD_createCStream()},
+          out_buffer_(ZSTD_CStreamOutSize())
+    {
+        if (!output_)
+            throw std::runtime_error{"failed to open " + filename};
+        if (!stream_)
+            throw std::runtime_error{"failed to create zstd stream"};
+
+        check(ZSTD_CCtx_setParameter(stream_, ZSTD_c_compressionLevel, level));
+        // fails harmlessly if libzstd was built without threading
+        ZSTD_CCtx_setParameter(stream_, ZSTD_c_nbWorkers,
+                               static_cast<int>(options.threads));
+    }
+
+    ~zstd_sink()
+    {
+        ZSTD_freeCStream(stream_);
+    }
+
+    void write(const char* buffer, std::size_t len) override
+    {
+        ZSTD_inBuffer in{buffer, len, 0};
+        while (in.pos < in.size)
+            compress(in, ZSTD_e_continue);
+    }
+
+    void close() override
+    {
+        ZSTD_inBuffer in{nullptr, 0, 0};
+        while (compress(in, ZSTD_e_end) != 0)
+        {
+            // keep flushing
+        }
+        output_.close();
+    }
+
+  private:
+    std::size_t compress(ZSTD_inBuffer& in, ZSTD_EndDirective mode)
+    {
+        ZSTD_outBuffer out{out_buffer_.data(), out_buffer_.size(), 0};
+        auto remaining = check(ZSTD_compressStream2(stream_, &out, &in, mode));
+        output_.write(out_buffer_.data(),
+                      static_cast<std::streamsize>(out.pos));
+        return remaining;
+    }
+
+    static std::size_t check(std::size_t res)
+    {
+        if (ZSTD_isError(res))
+            throw std::runtime_error{std::string{"zstd error: "}
+                                     + ZSTD_getErrorName(res)};
+        return res;
+    }
+
+    std::ofstream output_;
+    ZSTD_CStream* stream_;
+    std::vector<char> out_buffer_;
+};
+#endif
+
+/**
+ * Opens path for writing with the given codec. The path is used as is;
+ * tables are expected to end in codec_extension(c) once complete.
+ */
+inline std::unique_ptr<output_sink>
+open_output(const std::string& path, codec c,
+            const output_options& options = {})
+{
+    switch (c)
+    {
+        case codec::XZ:
+            return meta::make_unique<xz_sink>(path, options);
+        case codec::ZSTD:
+#ifdef STACKEXCHANGE_HAS_ZSTD
+            return meta::make_unique<zstd_sink>(path, options);
+#else
+            throw std::runtime_error{"zstd support was not compiled in"};
+#endif
+        case codec::NONE:
+            return meta::make_unique<raw_sink>(path);
+    }
+    throw std::runtime_error{"unknown codec"};
+}
+
+#endif
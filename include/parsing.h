@@ -8,10 +8,28 @@
 #ifndef STACKEXCHANGE_PARSING_H_
 #define STACKEXCHANGE_PARSING_H_
 
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define STACKEXCHANGE_HAS_X86 1
+#include <immintrin.h>
+#else
+#define STACKEXCHANGE_HAS_X86 0
+#endif
+
 #include <libxml/xmlreader.h>
 
 #include "date.h"
+#include "input.h"
 #include "meta/io/xzstream.h"
+#include "meta/meta.h"
+#include "meta/parallel/thread_pool.h"
 #include "meta/util/progress.h"
 #include "meta/util/string_view.h"
 #include "meta/util/optional.h"
@@ -61,9 +79,8 @@ class xml_string
 class xml_text_reader
 {
   public:
-    xml_text_reader(meta::io::xzifstream& input,
-                    meta::printing::progress& progress)
-        : input_(input), progress_(progress), reader_{make_xml_reader()}
+    xml_text_reader(input_source& input)
+        : input_(input), reader_{make_xml_reader()}
     {
     }
 
@@ -97,11 +114,8 @@ class xml_text_reader
             // Read callback
             [](void* context, char* buffer, int len) {
                 auto self = static_cast<xml_text_reader*>(context);
-                self->input_.read(buffer, len);
-
-                auto num_read = static_cast<int>(self->input_.gcount());
-                self->progress_(self->input_.bytes_read());
-                return num_read;
+                return static_cast<int>(
+                    self->input_.read(buffer, static_cast<std::size_t>(len)));
             },
             // Close callback
             [](void* /* context */) { return 0; },
@@ -115,14 +129,88 @@ class xml_text_reader
             XML_PARSE_NONET | XML_PARSE_NOBLANKS | XML_PARSE_RECOVER);
     }
 
-    meta::io::xzifstream& input_;
-    meta::printing::progress& progress_;
+    input_source& input_;
     xmlTextReaderPtr reader_;
 };
 
 using sys_milliseconds = date::sys_time<std::chrono::milliseconds>;
 
-inline sys_milliseconds parse_date(const std::string& date)
+/**
+ * Converts a proleptic Gregorian calendar date to the number of days since
+ * 1970-01-01 (Howard Hinnant's days_from_civil).
+ */
+constexpr int64_t days_from_civil(int64_t y, uint32_t m, uint32_t d)
+{
+    y -= m <= 2;
+    auto era = (y >= 0 ? y : y - 399) / 400;
+    auto yoe = static_cast<uint32_t>(y - era * 400);
+    auto doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    auto doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+constexpr uint32_t last_day_of_month(int64_t y, uint32_t m)
+{
+    return m != 2 ? (m == 4 || m == 6 || m == 9 || m == 11 ? 30 : 31)
+                  : (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0) ? 29 : 28);
+}
+
+/**
+ * Parses the fixed `YYYY-MM-DDTHH:MM:SS[.mmm]` layout used by every
+ * timestamp in the dumps without allocating.
+ *
+ * @return nullopt if the input does not have exactly that layout or
+ * contains an out of range field
+ */
+inline meta::util::optional<sys_milliseconds>
+parse_timestamp(meta::util::string_view str)
+{
+    if (str.size() != 19 && !(str.size() == 23 && str[19] == '.'))
+        return meta::util::nullopt;
+
+    // accumulate every digit check into a single flag so the common case
+    // runs straight through
+    uint32_t bad = 0;
+    auto digits = [&](std::size_t pos, std::size_t len) {
+        uint32_t value = 0;
+        for (std::size_t i = pos; i < pos + len; ++i)
+        {
+            auto digit = static_cast<uint32_t>(str[i] - '0');
+            bad |= digit > 9;
+            value = value * 10 + digit;
+        }
+        return value;
+    };
+
+    auto year = digits(0, 4);
+    auto month = digits(5, 2);
+    auto day = digits(8, 2);
+    auto hour = digits(11, 2);
+    auto minute = digits(14, 2);
+    auto second = digits(17, 2);
+    auto millis = str.size() == 23 ? digits(20, 3) : 0;
+
+    bad |= str[4] != '-' || str[7] != '-' || str[10] != 'T' || str[13] != ':'
+           || str[16] != ':';
+    if (bad)
+        return meta::util::nullopt;
+
+    if (month < 1 || month > 12 || day < 1
+        || day > last_day_of_month(year, month) || hour > 23 || minute > 59
+        || second > 59)
+        return meta::util::nullopt;
+
+    auto seconds = days_from_civil(year, month, day) * 86400
+                   + int64_t{hour} * 3600 + int64_t{minute} * 60 + second;
+    return sys_milliseconds{
+        std::chrono::milliseconds{seconds * 1000 + millis}};
+}
+
+/**
+ * Parses a timestamp with date::parse. This accepts anything date::parse
+ * does, but is far slower than parse_timestamp().
+ */
+inline sys_milliseconds parse_date_checked(const std::string& date)
 {
     std::stringstream ss{date};
     sys_milliseconds tp;
@@ -132,6 +220,957 @@ inline sys_milliseconds parse_date(const std::string& date)
     return tp;
 }
 
+inline sys_milliseconds parse_date(meta::util::string_view date)
+{
+    if (auto tp = parse_timestamp(date))
+        return *tp;
+    return parse_date_checked(date.to_string());
+}
+
+/**
+ * Byte search primitives used by the row scanner. Attribute values (and
+ * in particular the huge Body/Text values) make up most of every table, so
+ * skipping over them is done a full vector register at a time when the
+ * CPU supports it. The vector versions are compiled for their instruction
+ * sets whatever the target, and find_byte() and find_markup() pick one at
+ * run time, so that the binaries stay portable.
+ */
+inline const char* find_byte_scalar(const char* first, const char* last,
+                                    char c)
+{
+    auto pos = std::memchr(first, c, static_cast<std::size_t>(last - first));
+    return pos ? static_cast<const char*>(pos) : last;
+}
+
+inline bool is_markup_char(char c)
+{
+    return c == '"' || c == '=' || c == '<' || c == '>' || c == '&';
+}
+
+inline const char* find_markup_scalar(const char* first, const char* last)
+{
+    while (first != last && !is_markup_char(*first))
+        ++first;
+    return first;
+}
+
+#if STACKEXCHANGE_HAS_X86
+namespace detail
+{
+__attribute__((target("avx2"))) inline const char*
+find_byte_avx2(const char* first, const char* last, char c)
+{
+    auto needle = _mm256_set1_epi8(c);
+    for (; last - first >= 32; first += 32)
+    {
+        auto chunk
+            = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        auto mask = static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return find_byte_scalar(first, last, c);
+}
+
+__attribute__((target("sse4.2"))) inline const char*
+find_byte_sse42(const char* first, const char* last, char c)
+{
+    auto needle = _mm_set1_epi8(c);
+    for (; last - first >= 16; first += 16)
+    {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        auto mask = static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return find_byte_scalar(first, last, c);
+}
+
+__attribute__((target("avx2"))) inline const char*
+find_markup_avx2(const char* first, const char* last)
+{
+    auto quote = _mm256_set1_epi8('"');
+    auto eq = _mm256_set1_epi8('=');
+    auto lt = _mm256_set1_epi8('<');
+    auto gt = _mm256_set1_epi8('>');
+    auto amp = _mm256_set1_epi8('&');
+    for (; last - first >= 32; first += 32)
+    {
+        auto chunk
+            = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        auto hits = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                            _mm256_cmpeq_epi8(chunk, eq)),
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, lt),
+                                            _mm256_cmpeq_epi8(chunk, gt)),
+                            _mm256_cmpeq_epi8(chunk, amp)));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return find_markup_scalar(first, last);
+}
+
+__attribute__((target("sse4.2"))) inline const char*
+find_markup_sse42(const char* first, const char* last)
+{
+    auto set = _mm_setr_epi8('"', '=', '<', '>', '&', 0, 0, 0, 0, 0, 0, 0, 0,
+                             0, 0, 0);
+    for (; last - first >= 16; first += 16)
+    {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        auto idx = _mm_cmpestri(set, 5, chunk, 16,
+                                _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY
+                                    | _SIDD_LEAST_SIGNIFICANT);
+        if (idx != 16)
+            return first + idx;
+    }
+    return find_markup_scalar(first, last);
+}
+
+enum class vector_isa
+{
+    NONE,
+    SSE42,
+    AVX2
+};
+
+/**
+ * @return the widest instruction set the locators can use on this CPU
+ */
+inline vector_isa cpu_vector_isa()
+{
+    static const vector_isa isa = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return vector_isa::AVX2;
+        if (__builtin_cpu_supports("sse4.2"))
+            return vector_isa::SSE42;
+        return vector_isa::NONE;
+    }();
+    return isa;
+}
+}
+#endif
+
+/**
+ * @return a pointer to the first occurrence of c in [first, last), or last
+ */
+inline const char* find_byte(const char* first, const char* last, char c)
+{
+#if defined(__AVX2__)
+    // the build is for an AVX2 CPU anyway, so there is nothing to pick
+    return detail::find_byte_avx2(first, last, c);
+#elif STACKEXCHANGE_HAS_X86
+    switch (detail::cpu_vector_isa())
+    {
+        case detail::vector_isa::AVX2:
+            return detail::find_byte_avx2(first, last, c);
+        case detail::vector_isa::SSE42:
+            return detail::find_byte_sse42(first, last, c);
+        case detail::vector_isa::NONE:
+            break;
+    }
+    return find_byte_scalar(first, last, c);
+#else
+    return find_byte_scalar(first, last, c);
+#endif
+}
+
+/**
+ * @return a pointer to the first of `"`, `=`, `<`, `>` or `&` in
+ * [first, last), or last
+ */
+inline const char* find_markup(const char* first, const char* last)
+{
+#if defined(__AVX2__)
+    return detail::find_markup_avx2(first, last);
+#elif STACKEXCHANGE_HAS_X86
+    switch (detail::cpu_vector_isa())
+    {
+        case detail::vector_isa::AVX2:
+            return detail::find_markup_avx2(first, last);
+        case detail::vector_isa::SSE42:
+            return detail::find_markup_sse42(first, last);
+        case detail::vector_isa::NONE:
+            break;
+    }
+    return find_markup_scalar(first, last);
+#else
+    return find_markup_scalar(first, last);
+#endif
+}
+
+inline bool is_xml_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+/**
+ * Scans the attributes of a row element, starting just past the `<row`
+ * tag name, calling `on_attribute(name, value)` for each of them. Both
+ * views point into [first, last); the value is the raw text between the
+ * quotes and is *not* entity-decoded. If on_attribute returns true, the
+ * rest of the row is skipped by searching for the next '<' (which cannot
+ * occur inside an attribute value).
+ *
+ * @return a pointer just past the end of the element (or, if it was cut
+ * short, to the next '<' or last), or nullptr if the element does not end
+ * within [first, last)
+ */
+template <class Function>
+const char* scan_row(const char* first, const char* last,
+                     Function&& on_attribute)
+{
+    while (true)
+    {
+        while (first != last && is_xml_space(*first))
+            ++first;
+
+        if (first == last)
+            return nullptr;
+
+        if (*first == '/')
+        {
+            if (last - first < 2)
+                return nullptr;
+            if (first[1] != '>')
+                throw std::runtime_error{"malformed row element"};
+            return first + 2;
+        }
+
+        if (*first == '>')
+            return first + 1;
+
+        auto eq = find_markup(first, last);
+        if (eq == last)
+            return nullptr;
+        if (*eq != '=')
+            throw std::runtime_error{"malformed row attribute"};
+
+        auto name_end = eq;
+        while (name_end != first && is_xml_space(*(name_end - 1)))
+            --name_end;
+
+        auto quote = eq + 1;
+        while (quote != last && is_xml_space(*quote))
+            ++quote;
+
+        if (quote == last)
+            return nullptr;
+
+        if (*quote != '"' && *quote != '\'')
+            throw std::runtime_error{"malformed row attribute"};
+
+        auto value_end = find_byte(quote + 1, last, *quote);
+        if (value_end == last)
+            return nullptr;
+
+        auto done = on_attribute(
+            meta::util::string_view{
+                first, static_cast<std::size_t>(name_end - first)},
+            meta::util::string_view{
+                quote + 1, static_cast<std::size_t>(value_end - quote - 1)});
+        if (done)
+            return find_byte(value_end + 1, last, '<');
+        first = value_end + 1;
+    }
+}
+
+/**
+ * The set of attributes a row_scanner picks out of each row of a table.
+ * Names are interned up front with their lengths, so matching an
+ * attribute while scanning is a length check and a short memcmp against a
+ * handful of candidates. Fields are then accessed by their index in the
+ * schema.
+ *
+ * A schema can be narrowed to the fields one pass needs with project().
+ *
+ * The schema does not copy the names, so they must outlive it.
+ */
+class attribute_schema
+{
+  public:
+    attribute_schema(std::vector<meta::util::string_view> names)
+        : names_(std::move(names)), num_projected_{names_.size()}
+    {
+        if (names_.size() > 64)
+            throw std::invalid_argument{"too many fields in schema"};
+        projected_ = names_.size() == 64 ? ~uint64_t{0}
+                                         : (uint64_t{1} << names_.size()) - 1;
+    }
+
+    /**
+     * @return a copy of this schema that only matches the given fields.
+     * Field indices are unchanged, but every other attribute is skipped
+     * without being recorded and readers stop scanning a row (skipping,
+     * e.g., a trailing Text value entirely) once all of the projected
+     * fields have been seen. Accessors for other fields return nullopt.
+     */
+    attribute_schema project(std::initializer_list<std::size_t> fields) const
+    {
+        auto result = *this;
+        result.projected_ = 0;
+        for (auto field : fields)
+        {
+            if (field >= names_.size())
+                throw std::out_of_range{"field not in schema"};
+            result.projected_ |= uint64_t{1} << field;
+        }
+        result.num_projected_ = fields.size();
+        return result;
+    }
+
+    /**
+     * @return the index of the named field, or size() if it is not a
+     * (projected) part of the schema
+     */
+    std::size_t index(meta::util::string_view name) const
+    {
+        for (std::size_t i = 0; i < names_.size(); ++i)
+        {
+            if ((projected_ >> i & 1) && names_[i].size() == name.size()
+                && std::memcmp(names_[i].data(), name.data(), name.size())
+                       == 0)
+                return i;
+        }
+        return names_.size();
+    }
+
+    /**
+     * @return whether readers record the given field
+     */
+    bool is_projected(std::size_t field) const
+    {
+        return projected_ >> field & 1;
+    }
+
+    /**
+     * @return the number of fields a row can be cut short after
+     */
+    std::size_t num_projected() const
+    {
+        return num_projected_;
+    }
+
+    meta::util::string_view name(std::size_t field) const
+    {
+        return names_.at(field);
+    }
+
+    std::size_t size() const
+    {
+        return names_.size();
+    }
+
+  private:
+    std::vector<meta::util::string_view> names_;
+    uint64_t projected_;
+    std::size_t num_projected_;
+};
+
+/**
+ * Schemas for the tables the extractors read. Each lists only the
+ * attributes we actually use, in the order of the field enum.
+ */
+struct posts_table
+{
+    enum field : std::size_t
+    {
+        Id = 0,
+        PostTypeId,
+        ParentId,
+        AcceptedAnswerId,
+        CreationDate,
+        OwnerUserId,
+        Tags
+    };
+
+    static const attribute_schema& schema()
+    {
+        static attribute_schema schema{{"Id", "PostTypeId", "ParentId",
+                                        "AcceptedAnswerId", "CreationDate",
+                                        "OwnerUserId", "Tags"}};
+        return schema;
+    }
+};
+
+struct comments_table
+{
+    enum field : std::size_t
+    {
+        Id = 0,
+        PostId,
+        UserId,
+        CreationDate
+    };
+
+    static const attribute_schema& schema()
+    {
+        static attribute_schema schema{
+            {"Id", "PostId", "UserId", "CreationDate"}};
+        return schema;
+    }
+};
+
+struct post_history_table
+{
+    enum field : std::size_t
+    {
+        Id = 0,
+        PostHistoryTypeId,
+        PostId,
+        UserId,
+        CreationDate
+    };
+
+    static const attribute_schema& schema()
+    {
+        static attribute_schema schema{
+            {"Id", "PostHistoryTypeId", "PostId", "UserId", "CreationDate"}};
+        return schema;
+    }
+};
+
+struct votes_table
+{
+    enum field : std::size_t
+    {
+        Id = 0,
+        PostId,
+        VoteTypeId,
+        UserId,
+        CreationDate
+    };
+
+    static const attribute_schema& schema()
+    {
+        static attribute_schema schema{
+            {"Id", "PostId", "VoteTypeId", "UserId", "CreationDate"}};
+        return schema;
+    }
+};
+
+/**
+ * @return the full schema of the named table (e.g. "Posts"), or nullptr
+ * if it is not one of the tables above
+ */
+inline const attribute_schema* find_schema(const std::string& table)
+{
+    if (table == "Posts")
+        return &posts_table::schema();
+    if (table == "Comments")
+        return &comments_table::schema();
+    if (table == "PostHistory")
+        return &post_history_table::schema();
+    if (table == "Votes")
+        return &votes_table::schema();
+    return nullptr;
+}
+
+/**
+ * Parses a decimal attribute value. A leading minus sign wraps around the
+ * way std::stoul does, since the dumps use -1 for the Community user.
+ */
+inline uint64_t parse_u64(meta::util::string_view str)
+{
+    auto negative = !str.empty() && str[0] == '-';
+    if (negative)
+        str = str.substr(1);
+
+    if (str.empty() || str.size() > 19)
+        throw std::runtime_error{"invalid integer: " + str.to_string()};
+
+    uint64_t value = 0;
+    for (auto c : str)
+    {
+        auto digit = static_cast<uint64_t>(c - '0');
+        if (digit > 9)
+            throw std::runtime_error{"invalid integer: " + str.to_string()};
+        value = value * 10 + digit;
+    }
+    return negative ? 0 - value : value;
+}
+
+/**
+ * Replaces out with value after decoding XML entity references. Values
+ * returned by row_scanner are left encoded, so this is needed for any
+ * free-text field (like Tags) that is passed along.
+ */
+inline void xml_unescape(meta::util::string_view value, std::string& out)
+{
+    out.clear();
+    auto first = value.data();
+    auto last = value.data() + value.size();
+    while (first != last)
+    {
+        auto amp = find_byte(first, last, '&');
+        out.append(first, amp);
+        if (amp == last)
+            break;
+
+        auto semi = find_byte(amp, last, ';');
+        if (semi == last)
+            throw std::runtime_error{"unterminated entity reference: "
+                                     + value.to_string()};
+
+        meta::util::string_view entity{
+            amp + 1, static_cast<std::size_t>(semi - amp - 1)};
+        if (entity == "lt")
+            out.push_back('<');
+        else if (entity == "gt")
+            out.push_back('>');
+        else if (entity == "amp")
+            out.push_back('&');
+        else if (entity == "quot")
+            out.push_back('"');
+        else if (entity == "apos")
+            out.push_back('\'');
+        else if (entity.size() > 1 && entity[0] == '#')
+        {
+            auto hex = entity[1] == 'x' || entity[1] == 'X';
+            auto cp = std::stoul(entity.substr(hex ? 2 : 1).to_string(),
+                                 nullptr, hex ? 16 : 10);
+
+            // encode the code point as UTF-8
+            if (cp < 0x80)
+            {
+                out.push_back(static_cast<char>(cp));
+            }
+            else if (cp < 0x800)
+            {
+                out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+            else if (cp < 0x10000)
+            {
+                out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+            else
+            {
+                out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+        }
+        else
+        {
+            throw std::runtime_error{"unknown entity reference: "
+                                     + entity.to_string()};
+        }
+        first = semi + 1;
+    }
+}
+
+/**
+ * Reads the rows of one table. By default, the typed accessors parse the
+ * schema fields of the current row straight from the input buffer; their
+ * results (and any views they return) are only valid until the next call
+ * to read_next(). Readers over other formats override them.
+ */
+class row_reader
+{
+  public:
+    virtual ~row_reader() = default;
+
+    /**
+     * Advances to the next row element.
+     * @return false if there are no more rows
+     */
+    virtual bool read_next() = 0;
+
+    /**
+     * @return the raw value of a field on the current row, if present
+     */
+    virtual meta::util::optional<meta::util::string_view>
+    as_view(std::size_t field) const
+    {
+        const auto& value = fields_[field];
+        if (!value.data())
+            return meta::util::nullopt;
+        return value;
+    }
+
+    /**
+     * @return the value of an integer field on the current row, if present
+     */
+    virtual meta::util::optional<uint64_t> as_u64(std::size_t field) const
+    {
+        const auto& value = fields_[field];
+        if (!value.data())
+            return meta::util::nullopt;
+        return parse_u64(value);
+    }
+
+    /**
+     * @return the value of a timestamp field on the current row, if
+     * present
+     */
+    virtual meta::util::optional<sys_milliseconds>
+    as_timestamp(std::size_t field) const
+    {
+        const auto& value = fields_[field];
+        if (!value.data())
+            return meta::util::nullopt;
+        return parse_date(value);
+    }
+
+  protected:
+    /// the value of each schema field on the current row, used by the
+    /// default accessors; a null data() marks a missing attribute
+    const meta::util::string_view* fields_ = nullptr;
+};
+
+/**
+ * A purpose-built reader for the StackExchange dumps, which consist only
+ * of a single table element containing flat `<row .../>` elements. Rows
+ * are scanned directly out of the decompressed buffer and only the
+ * attributes in the reader's schema are kept, as views into that buffer,
+ * so reading a row performs no allocation. The typed accessors parse
+ * straight from those views.
+ *
+ * Views are only valid until the next call to read_next().
+ */
+class row_scanner : public row_reader
+{
+  public:
+    row_scanner(input_source& input, const attribute_schema& schema,
+                std::size_t buffer_size = 1024 * 1024)
+        : input_(input),
+          schema_(schema),
+          buffer_(buffer_size),
+          row_(schema.size())
+    {
+        fields_ = row_.data();
+    }
+
+    bool read_next() override
+    {
+        while (true)
+        {
+            auto first = buffer_.data() + pos_;
+            auto last = buffer_.data() + end_;
+
+            auto lt = find_byte(first, last, '<');
+            if (lt == last)
+            {
+                pos_ = end_;
+                if (!fill())
+                    return false;
+                continue;
+            }
+            pos_ = static_cast<std::size_t>(lt - buffer_.data());
+
+            // "<row" plus one whitespace character
+            if (last - lt < 5)
+            {
+                if (!fill())
+                    return false;
+                continue;
+            }
+
+            if (std::memcmp(lt, "<row", 4) == 0 && is_xml_space(lt[4]))
+            {
+                std::fill(row_.begin(), row_.end(), meta::util::string_view{});
+                std::size_t found = 0;
+                auto row_end = scan_row(
+                    lt + 5, last, [&](meta::util::string_view name,
+                                      meta::util::string_view value) {
+                        auto field = schema_.index(name);
+                        if (field < row_.size())
+                        {
+                            row_[field] = value;
+                            ++found;
+                        }
+                        return found == schema_.num_projected();
+                    });
+                if (!row_end)
+                {
+                    if (!fill())
+                        return false;
+                    continue;
+                }
+                pos_ = static_cast<std::size_t>(row_end - buffer_.data());
+                row_offset_
+                    = offset_ + static_cast<uint64_t>(lt - buffer_.data());
+                return true;
+            }
+
+            // any other tag (the XML declaration or the table element
+            // itself): skip past it
+            auto gt = find_byte(lt + 1, last, '>');
+            if (gt == last)
+            {
+                if (!fill())
+                    return false;
+                continue;
+            }
+            pos_ = static_cast<std::size_t>(gt + 1 - buffer_.data());
+        }
+    }
+
+    /**
+     * @return the offset in the input of the '<' that starts the current
+     * row
+     */
+    uint64_t row_offset() const
+    {
+        return row_offset_;
+    }
+
+  private:
+    /**
+     * Moves the unconsumed bytes to the front of the buffer (growing it if
+     * a single row fills it completely) and reads more input after them.
+     *
+     * @return false if no more input could be read
+     */
+    bool fill()
+    {
+        if (pos_ == 0 && end_ == buffer_.size())
+            buffer_.resize(buffer_.size() * 2);
+
+        std::copy(buffer_.begin() + static_cast<std::ptrdiff_t>(pos_),
+                  buffer_.begin() + static_cast<std::ptrdiff_t>(end_),
+                  buffer_.begin());
+        offset_ += pos_;
+        end_ -= pos_;
+        pos_ = 0;
+
+        auto num_read
+            = input_.read(buffer_.data() + end_, buffer_.size() - end_);
+        end_ += num_read;
+        return num_read > 0;
+    }
+
+    input_source& input_;
+    const attribute_schema& schema_;
+    std::vector<char> buffer_;
+    std::size_t pos_ = 0;
+    std::size_t end_ = 0;
+    /// the offset in the input of buffer_[0]
+    uint64_t offset_ = 0;
+    uint64_t row_offset_ = 0;
+    std::vector<meta::util::string_view> row_;
+};
+
+/**
+ * Appends the schema fields of every complete row in [first, last) to
+ * fields, schema.size() values per row.
+ *
+ * @return the number of rows found
+ */
+inline std::size_t scan_rows(const char* first, const char* last,
+                             const attribute_schema& schema,
+                             std::vector<meta::util::string_view>& fields)
+{
+    std::size_t num_rows = 0;
+    while (true)
+    {
+        auto lt = find_byte(first, last, '<');
+        if (last - lt < 5)
+            return num_rows;
+
+        if (std::memcmp(lt, "<row", 4) == 0 && is_xml_space(lt[4]))
+        {
+            auto row = fields.size();
+            fields.resize(row + schema.size());
+            std::size_t found = 0;
+            auto row_end = scan_row(
+                lt + 5, last, [&](meta::util::string_view name,
+                                  meta::util::string_view value) {
+                    auto field = schema.index(name);
+                    if (field < schema.size())
+                    {
+                        fields[row + field] = value;
+                        ++found;
+                    }
+                    return found == schema.num_projected();
+                });
+            if (!row_end)
+            {
+                // a truncated final row
+                fields.resize(row);
+                return num_rows;
+            }
+            ++num_rows;
+            first = row_end;
+        }
+        else
+        {
+            first = find_byte(lt + 1, last, '>');
+        }
+    }
+}
+
+/**
+ * Cuts the input at row boundaries into large chunks that are scanned
+ * concurrently on a thread pool. Rows are still handed out strictly in
+ * file order, so the results are identical to a row_scanner's.
+ */
+class chunked_row_scanner : public row_reader
+{
+  public:
+    chunked_row_scanner(input_source& input, const attribute_schema& schema,
+                        meta::parallel::thread_pool& pool,
+                        std::size_t chunk_size = 16 * 1024 * 1024)
+        : input_(input),
+          schema_(schema),
+          pool_(pool),
+          chunk_size_{chunk_size},
+          max_pending_{2 * pool.size()}
+    {
+        // with either, no chunk would ever be scanned
+        if (pool.size() == 0)
+            throw std::runtime_error{"cannot scan chunks without threads"};
+        if (chunk_size_ == 0)
+            throw std::runtime_error{"chunk size must be positive"};
+    }
+
+    ~chunked_row_scanner()
+    {
+        // the tasks refer to the schema, so let them finish
+        for (auto& fut : pending_)
+            fut.wait();
+    }
+
+    bool read_next() override
+    {
+        while (!current_ || next_row_ == current_->num_rows)
+        {
+            submit_chunks();
+            if (pending_.empty())
+                return false;
+
+            current_ = pending_.front().get();
+            pending_.pop_front();
+            next_row_ = 0;
+        }
+
+        fields_ = current_->fields.data() + next_row_ * schema_.size();
+        ++next_row_;
+        return true;
+    }
+
+  private:
+    struct parsed_chunk
+    {
+        std::vector<char> data;
+        std::vector<meta::util::string_view> fields;
+        std::size_t num_rows = 0;
+    };
+
+    /**
+     * Reads chunks and queues them for scanning until enough are in
+     * flight to keep the pool busy.
+     */
+    void submit_chunks()
+    {
+        while (pending_.size() < max_pending_)
+        {
+            auto chunk = std::make_shared<parsed_chunk>();
+            if (!read_chunk(chunk->data))
+                return;
+
+            const auto& schema = schema_;
+            pending_.push_back(pool_.submit_task([chunk, &schema]() {
+                const auto& data = chunk->data;
+                chunk->num_rows = scan_rows(data.data(),
+                                            data.data() + data.size(), schema,
+                                            chunk->fields);
+                return chunk;
+            }));
+        }
+    }
+
+    /**
+     * Reads the next chunk, which ends just before the last '<' read so
+     * far (which can never occur inside an attribute value). The remainder
+     * is carried over to the start of the following chunk.
+     *
+     * @return false if the input is exhausted
+     */
+    bool read_chunk(std::vector<char>& chunk)
+    {
+        chunk.swap(carry_);
+        carry_.clear();
+        while (!eof_)
+        {
+            auto old_size = chunk.size();
+            chunk.resize(old_size + chunk_size_);
+
+            auto size = old_size;
+            while (size < chunk.size())
+            {
+                auto num_read
+                    = input_.read(chunk.data() + size, chunk.size() - size);
+                if (num_read == 0)
+                {
+                    eof_ = true;
+                    break;
+                }
+                size += num_read;
+            }
+            chunk.resize(size);
+            if (eof_)
+                break;
+
+            auto cut = chunk.size();
+            while (cut > 1 && chunk[cut - 1] != '<')
+                --cut;
+            if (cut > 1)
+            {
+                carry_.assign(
+                    chunk.begin() + static_cast<std::ptrdiff_t>(cut - 1),
+                    chunk.end());
+                chunk.resize(cut - 1);
+                return true;
+            }
+            // a single row spans the whole chunk; keep reading
+        }
+        return !chunk.empty();
+    }
+
+    input_source& input_;
+    const attribute_schema& schema_;
+    meta::parallel::thread_pool& pool_;
+    const std::size_t chunk_size_;
+    const std::size_t max_pending_;
+
+    std::deque<std::future<std::shared_ptr<parsed_chunk>>> pending_;
+    std::shared_ptr<parsed_chunk> current_;
+    std::size_t next_row_ = 0;
+    std::vector<char> carry_;
+    bool eof_ = false;
+};
+
+/**
+ * Options controlling how a table's rows are parsed.
+ */
+struct parse_options
+{
+    /// the pool to scan chunks on; rows are scanned on the calling thread
+    /// if this is null
+    meta::parallel::thread_pool* pool = nullptr;
+    /// the size of the chunks handed to the pool
+    std::size_t chunk_size = 16 * 1024 * 1024;
+};
+
+inline std::unique_ptr<row_reader>
+make_row_reader(input_source& input, const attribute_schema& schema,
+                const parse_options& options)
+{
+    if (options.pool)
+        return meta::make_unique<chunked_row_scanner>(
+            input, schema, *options.pool, options.chunk_size);
+    return meta::make_unique<row_scanner>(input, schema);
+}
+
 struct time_span
 {
     sys_milliseconds earliest;
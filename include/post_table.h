@@ -0,0 +1,259 @@
+/**
+ * @file post_table.h
+ * @author Chase Geigle
+ *
+ * A flat table of the posts of a community, indexed by post id, used to
+ * classify the actions taken on them.
+ */
+
+#ifndef STACKEXCHANGE_POST_TABLE_H_
+#define STACKEXCHANGE_POST_TABLE_H_
+
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "actions.h"
+
+#include "meta/io/filesystem.h"
+#include "meta/io/mmap_file.h"
+#include "meta/io/packed.h"
+#include "meta/meta.h"
+#include "meta/util/optional.h"
+
+/**
+ * The owner of every post, and for answers the owner of the question they
+ * answer, in an array of 12-byte entries indexed by post id (which are
+ * dense). A bitmap records which ids are actually posts, so classifying an
+ * action is a bitmap test plus a single entry read.
+ */
+class post_table
+{
+  public:
+    void add_question(post_id post, user_id owner)
+    {
+        auto& entry = insert(post);
+        entry.owner = compact_user_id(owner);
+    }
+
+    void add_answer(post_id post, user_id owner, post_id question)
+    {
+        auto& entry = insert(post);
+        entry.owner = compact_user_id(owner);
+        entry.question = to_index(question);
+        entry.is_answer = true;
+    }
+
+    /**
+     * Copies the owner of each answer's question into the answer. Must be
+     * called once every post has been added, before comment_type(). Only
+     * the posts added since the last call are linked, so posts with higher
+     * ids can be added to a linked table and linked in turn.
+     */
+    void link()
+    {
+        for (std::size_t i = linked_; i < posts_.size(); ++i)
+        {
+            auto& entry = posts_[i];
+            if (!known_[i] || !entry.is_answer)
+                continue;
+
+            entry.has_question = known(entry.question);
+            if (entry.has_question)
+            {
+                const auto& parent = posts_[entry.question];
+                entry.parent_is_answer = parent.is_answer;
+                entry.question = parent.owner;
+            }
+        }
+        linked_ = posts_.size();
+    }
+
+    /**
+     * @return the memory an entry takes up
+     */
+    static constexpr std::size_t entry_bytes()
+    {
+        return sizeof(entry);
+    }
+
+    /**
+     * @return the memory held by the entries
+     */
+    uint64_t bytes() const
+    {
+        return known_.size() * entry_bytes();
+    }
+
+    /**
+     * Writes a linked table out, entries first and then the bitmap.
+     */
+    void save(std::ostream& output) const
+    {
+        meta::io::packed::write(output, static_cast<uint64_t>(known_.size()));
+        output.write(reinterpret_cast<const char*>(entries_),
+                     static_cast<std::streamsize>(bytes()));
+
+        std::vector<char> bits((known_.size() + 7) / 8);
+        for (std::size_t i = 0; i < known_.size(); ++i)
+        {
+            if (known_[i])
+                bits[i / 8] |= static_cast<char>(1 << i % 8);
+        }
+        output.write(bits.data(), static_cast<std::streamsize>(bits.size()));
+    }
+
+    /**
+     * Reads back a table written by save().
+     */
+    static post_table load(std::istream& input)
+    {
+        post_table table;
+        uint64_t size = 0;
+        meta::io::packed::read(input, size);
+
+        table.posts_.resize(size);
+        table.known_.resize(size);
+        input.read(reinterpret_cast<char*>(table.posts_.data()),
+                   static_cast<std::streamsize>(table.bytes()));
+
+        std::vector<char> bits((size + 7) / 8);
+        input.read(bits.data(), static_cast<std::streamsize>(bits.size()));
+        if (!input)
+            throw std::runtime_error{"truncated post table"};
+
+        for (std::size_t i = 0; i < size; ++i)
+            table.known_[i] = (bits[i / 8] >> i % 8) & 1;
+
+        table.entries_ = table.posts_.data();
+        table.linked_ = size;
+        return table;
+    }
+
+    /**
+     * Moves the entries out of memory into a memory-mapped file, whose
+     * pages the kernel can drop and read back as needed. The file is
+     * removed as soon as it is mapped. No posts may be added afterwards.
+     */
+    void map_to(const std::string& filename)
+    {
+        if (posts_.empty())
+            return;
+
+        {
+            std::ofstream output{filename, std::ios::binary};
+            output.write(reinterpret_cast<const char*>(posts_.data()),
+                         static_cast<std::streamsize>(bytes()));
+            if (!output)
+                throw std::runtime_error{"failed to write " + filename};
+        }
+        mapped_ = meta::make_unique<meta::io::mmap_file>(filename);
+        meta::filesystem::delete_file(filename);
+
+        posts_ = {};
+        entries_ = reinterpret_cast<const entry*>(mapped_->begin());
+    }
+
+    bool contains(post_id post) const
+    {
+        return known(static_cast<uint64_t>(post));
+    }
+
+    /**
+     * @return how a post relates to a user, or nullopt if it is unknown
+     */
+    meta::util::optional<content_type> content(post_id post,
+                                               user_id user) const
+    {
+        if (!contains(post))
+            return meta::util::nullopt;
+
+        const auto& entry = entries_[static_cast<uint64_t>(post)];
+        auto mine = entry.owner == compact_user_id(user);
+        if (entry.is_answer)
+            return mine ? content_type::MY_ANSWER : content_type::OTHER_ANSWER;
+        return mine ? content_type::MY_QUESTION : content_type::OTHER_QUESTION;
+    }
+
+    /**
+     * @return the action a user commenting on a post takes, or nullopt if
+     * the post (or, for an answer, its question) is unknown
+     */
+    meta::util::optional<action_type> comment_type(post_id post,
+                                                   user_id user) const
+    {
+        if (!contains(post))
+            return meta::util::nullopt;
+
+        const auto& entry = entries_[static_cast<uint64_t>(post)];
+        auto uid = compact_user_id(user);
+        auto mine = entry.owner == uid;
+        if (!entry.is_answer)
+            return mine ? action_type::COMMENT_MQ : action_type::COMMENT_OQ;
+
+        // comment was on an answer. Was the question our own?
+        if (!entry.has_question)
+            return meta::util::nullopt;
+
+        // an answer to an answer is never on our own question
+        if (!entry.parent_is_answer && entry.question == uid)
+            return mine ? action_type::COMMENT_MA_MQ
+                        : action_type::COMMENT_OA_MQ;
+        return mine ? action_type::COMMENT_MA_OQ : action_type::COMMENT_OA_OQ;
+    }
+
+  private:
+    struct entry
+    {
+        uint32_t owner = 0;
+        /// for answers, the id of the question until link(), and the
+        /// owner of the question after
+        uint32_t question = 0;
+        bool is_answer = false;
+        /// whether the question of an answer is known (after link())
+        bool has_question = false;
+        bool parent_is_answer = false;
+    };
+
+    static uint32_t to_index(post_id post)
+    {
+        auto id = static_cast<uint64_t>(post);
+        if (id >= std::numeric_limits<uint32_t>::max())
+            throw std::out_of_range{"post id does not fit in 32 bits"};
+        return static_cast<uint32_t>(id);
+    }
+
+    bool known(uint64_t idx) const
+    {
+        return idx < known_.size() && known_[idx];
+    }
+
+    entry& insert(post_id post)
+    {
+        auto idx = to_index(post);
+        if (idx >= posts_.size())
+        {
+            posts_.resize(idx + 1);
+            known_.resize(idx + 1);
+            entries_ = posts_.data();
+        }
+        known_[idx] = true;
+        return posts_[idx];
+    }
+
+    std::vector<entry> posts_;
+    std::vector<bool> known_;
+    /// the entries, in posts_ or in mapped_
+    const entry* entries_ = nullptr;
+    std::unique_ptr<meta::io::mmap_file> mapped_;
+    /// the number of entries link() has already been through
+    std::size_t linked_ = 0;
+};
+
+#endif
@@ -0,0 +1,109 @@
+/**
+ * @file progress_report.h
+ * @author Chase Geigle
+ *
+ * Where the sources of table bytes (and rows) report how far along they
+ * are: a progress bar of their own, or a share of one that several
+ * inputs read at the same time report to together.
+ */
+
+#ifndef STACKEXCHANGE_PROGRESS_REPORT_H_
+#define STACKEXCHANGE_PROGRESS_REPORT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "meta/logging/logger.h"
+#include "meta/util/progress.h"
+
+class combined_progress;
+
+/**
+ * Passes the position of a single input on to a progress bar. Converts
+ * implicitly from a progress bar, so anything taking a progress_report
+ * can be given a bar of its own.
+ */
+class progress_report
+{
+  public:
+    progress_report(meta::printing::progress& bar) : bar_{&bar}
+    {
+        // nothing
+    }
+
+    void operator()(uint64_t position)
+    {
+        if (!total_)
+        {
+            (*bar_)(position);
+            return;
+        }
+
+        // a combined bar tracks the sum of the inputs' positions
+        if (position <= position_)
+            return;
+        auto read = position - position_;
+        position_ = position;
+        (*bar_)(*total_ += read);
+    }
+
+  private:
+    friend class combined_progress;
+
+    progress_report(meta::printing::progress& bar,
+                    std::atomic<uint64_t>& total)
+        : bar_{&bar}, total_{&total}
+    {
+        // nothing
+    }
+
+    meta::printing::progress* bar_;
+    std::atomic<uint64_t>* total_ = nullptr;
+    uint64_t position_ = 0;
+};
+
+/**
+ * A single progress bar over several inputs, possibly read on different
+ * threads, with a line for each input as it finishes, so that concurrent
+ * passes do not fight over the terminal.
+ */
+class combined_progress
+{
+  public:
+    /**
+     * @param length the sum of the sizes of the inputs
+     */
+    combined_progress(const std::string& prefix, uint64_t length)
+        : bar_{prefix, length}
+    {
+        // nothing
+    }
+
+    /**
+     * @return the report for one more input
+     */
+    progress_report part()
+    {
+        return {bar_, total_};
+    }
+
+    /**
+     * Prints a line about a finished input, above the bar.
+     */
+    void finished(const std::string& message)
+    {
+        LOG(progress) << "\r" << message << "\n" << ENDLG;
+    }
+
+    void end()
+    {
+        bar_.end();
+    }
+
+  private:
+    meta::printing::progress bar_;
+    std::atomic<uint64_t> total_{0};
+};
+
+#endif
@@ -0,0 +1,287 @@
+/**
+ * @file sequence_file.h
+ * @author Chase Geigle
+ *
+ * The layout of the time slice files written by extract-sequences
+ * ("<prefix>.NNN.bin"), and a reader for them.
+ *
+ * A version 2 file is a 48-byte header (see sequence_file_header)
+ * followed by three fixed-width tables and the actions themselves:
+ *
+ * - the users: num_users + 1 16-byte records (see sequence_user_record),
+ *   sorted by user id, giving each user's id and the index of their first
+ *   session. The final record only marks the end of the last user's
+ *   sessions.
+ * - the sessions: num_sessions + 1 uint64_t offsets into the actions at
+ *   which each session starts, the final one being num_actions
+ * - the actions: num_actions one-byte action_types
+ *
+ * so finding a user's sessions, or a session's actions, is two table
+ * reads. All values are in host byte order. The slices of a prefix are
+ * found by name (see sequence_filename()).
+ *
+ * Version 1 files, written before there was a header, are the number of
+ * users followed by each user's sessions as nested io::packed vectors,
+ * without user ids. They are still read, by decoding them into memory.
+ */
+
+#ifndef STACKEXCHANGE_SEQUENCE_FILE_H_
+#define STACKEXCHANGE_SEQUENCE_FILE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "actions.h"
+
+#include "meta/io/mmap_file.h"
+#include "meta/io/packed.h"
+#include "meta/meta.h"
+#include "meta/util/array_view.h"
+#include "meta/util/optional.h"
+
+struct sequence_file_header
+{
+    /// "seqslice"
+    static const uint64_t file_magic = 0x6563696c73716573;
+    static const uint32_t current_version = 2;
+    /// set when users have an empty entry in every slice between their
+    /// first and last active ones (--dense-slices)
+    static const uint32_t dense_flag = 1;
+
+    uint64_t magic = file_magic;
+    uint32_t version = current_version;
+    uint32_t flags = 0;
+    /// the index of this slice among those of its prefix
+    uint64_t slice = 0;
+    uint64_t num_users = 0;
+    uint64_t num_sessions = 0;
+    uint64_t num_actions = 0;
+};
+
+struct sequence_user_record
+{
+    /// the user's id (the Community user's -1 wrapped around)
+    uint64_t user;
+    /// the index of the user's first session
+    uint64_t first_session;
+};
+
+static_assert(sizeof(sequence_file_header) == 48,
+              "sequence file header must be packed");
+static_assert(sizeof(sequence_user_record) == 16,
+              "sequence user records must be packed");
+
+/**
+ * @return the name of the file holding a time slice of a prefix
+ */
+inline std::string sequence_filename(const std::string& prefix,
+                                     std::size_t slice)
+{
+    std::stringstream name;
+    name << prefix << "." << std::setw(3) << std::setfill('0') << slice
+         << ".bin";
+    return name.str();
+}
+
+/**
+ * A time slice file opened for reading. Version 2 files are memory
+ * mapped, and sessions are views straight into the mapping; version 1
+ * files are decoded into memory, and have no user ids.
+ */
+class sequence_file
+{
+  public:
+    using session_type = meta::util::array_view<const action_type>;
+
+    sequence_file(const std::string& filename)
+    {
+        auto mapped = meta::make_unique<meta::io::mmap_file>(filename);
+        if (mapped->size() >= sizeof(header_)
+            && std::memcmp(mapped->begin(), &header_.magic,
+                           sizeof(header_.magic))
+                   == 0)
+        {
+            std::memcpy(&header_, mapped->begin(), sizeof(header_));
+            if (header_.version != sequence_file_header::current_version)
+                throw std::runtime_error{
+                    filename + " has unsupported version "
+                    + std::to_string(header_.version)};
+
+            auto users_end
+                = sizeof(header_)
+                  + (header_.num_users + 1) * sizeof(sequence_user_record);
+            auto sessions_end
+                = users_end + (header_.num_sessions + 1) * sizeof(uint64_t);
+            if (mapped->size() != sessions_end + header_.num_actions)
+                throw std::runtime_error{"truncated sequence file "
+                                         + filename};
+
+            users_ = reinterpret_cast<const sequence_user_record*>(
+                mapped->begin() + sizeof(header_));
+            sessions_ = reinterpret_cast<const uint64_t*>(mapped->begin()
+                                                          + users_end);
+            actions_ = reinterpret_cast<const action_type*>(mapped->begin()
+                                                            + sessions_end);
+            mapped_ = std::move(mapped);
+        }
+        else
+        {
+            mapped.reset();
+            read_version_1(filename);
+        }
+    }
+
+    /**
+     * @return the version of the file's format
+     */
+    uint32_t version() const
+    {
+        return header_.version;
+    }
+
+    /**
+     * @return the index of the time slice, or nullopt for a version 1
+     * file
+     */
+    meta::util::optional<uint64_t> slice() const
+    {
+        if (version() < 2)
+            return meta::util::nullopt;
+        return header_.slice;
+    }
+
+    bool dense() const
+    {
+        return header_.flags & sequence_file_header::dense_flag;
+    }
+
+    uint64_t num_users() const
+    {
+        return header_.num_users;
+    }
+
+    uint64_t num_sessions() const
+    {
+        return header_.num_sessions;
+    }
+
+    uint64_t num_actions() const
+    {
+        return header_.num_actions;
+    }
+
+    /**
+     * @return the id of the user at an index, or nullopt for a version 1
+     * file
+     */
+    meta::util::optional<user_id> user(std::size_t idx) const
+    {
+        if (version() < 2)
+            return meta::util::nullopt;
+        return user_id{users_[idx].user};
+    }
+
+    /**
+     * @return the index of a user, or nullopt if the user has no entry
+     * (or the file is version 1)
+     */
+    meta::util::optional<std::size_t> find(user_id user) const
+    {
+        if (version() < 2)
+            return meta::util::nullopt;
+
+        auto id = static_cast<uint64_t>(user);
+        auto last = users_ + num_users();
+        auto it = std::lower_bound(
+            users_, last, id,
+            [](const sequence_user_record& record, uint64_t value) {
+                return record.user < value;
+            });
+        if (it == last || it->user != id)
+            return meta::util::nullopt;
+        return static_cast<std::size_t>(it - users_);
+    }
+
+    /**
+     * @return the number of sessions of the user at an index
+     */
+    std::size_t num_sessions(std::size_t idx) const
+    {
+        return users_[idx + 1].first_session - users_[idx].first_session;
+    }
+
+    /**
+     * @return a session of the user at an index
+     */
+    session_type session(std::size_t idx, std::size_t session) const
+    {
+        auto global = users_[idx].first_session + session;
+        return {actions_ + sessions_[global],
+                sessions_[global + 1] - sessions_[global]};
+    }
+
+  private:
+    void read_version_1(const std::string& filename)
+    {
+        std::ifstream input{filename, std::ios::binary};
+        if (!input)
+            throw std::runtime_error{"failed to open " + filename};
+
+        header_.version = 1;
+        meta::io::packed::read(input, header_.num_users);
+
+        owned_users_.reserve(header_.num_users + 1);
+        owned_sessions_.push_back(0);
+        for (uint64_t i = 0; i < header_.num_users; ++i)
+        {
+            owned_users_.push_back({i, owned_sessions_.size() - 1});
+
+            uint64_t num_sessions = 0;
+            meta::io::packed::read(input, num_sessions);
+            for (uint64_t s = 0; s < num_sessions; ++s)
+            {
+                uint64_t length = 0;
+                meta::io::packed::read(input, length);
+                for (uint64_t a = 0; a < length; ++a)
+                {
+                    action_type type;
+                    meta::io::packed::read(input, type);
+                    owned_actions_.push_back(type);
+                }
+                owned_sessions_.push_back(owned_actions_.size());
+            }
+        }
+        if (!input)
+            throw std::runtime_error{"failed to read " + filename};
+
+        header_.num_sessions = owned_sessions_.size() - 1;
+        header_.num_actions = owned_actions_.size();
+        owned_users_.push_back({header_.num_users, header_.num_sessions});
+
+        users_ = owned_users_.data();
+        sessions_ = owned_sessions_.data();
+        actions_ = owned_actions_.data();
+    }
+
+    sequence_file_header header_;
+    const sequence_user_record* users_ = nullptr;
+    const uint64_t* sessions_ = nullptr;
+    const action_type* actions_ = nullptr;
+
+    /// the mapping of a version 2 file
+    std::unique_ptr<meta::io::mmap_file> mapped_;
+    /// the tables decoded from a version 1 file
+    std::vector<sequence_user_record> owned_users_;
+    std::vector<uint64_t> owned_sessions_;
+    std::vector<action_type> owned_actions_;
+};
+
+#endif
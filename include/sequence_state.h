@@ -0,0 +1,170 @@
+/**
+ * @file sequence_state.h
+ * @author Chase Geigle
+ *
+ * What extract-sequences keeps of a community between runs with
+ * --incremental, so that a later dump (which is a superset of the earlier
+ * one) only has to be read past where the earlier one ended.
+ */
+
+#ifndef STACKEXCHANGE_SEQUENCE_STATE_H_
+#define STACKEXCHANGE_SEQUENCE_STATE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "action_log.h"
+#include "parsing.h"
+#include "post_table.h"
+
+#include "meta/io/filesystem.h"
+#include "meta/io/packed.h"
+
+/**
+ * How far into a table a run has read. Rows are appended to a table in id
+ * order, so the rows of a newer dump past last_id are the new ones.
+ */
+struct table_watermark
+{
+    /// the highest row id read
+    uint64_t last_id = 0;
+    /// the latest CreationDate read
+    sys_milliseconds latest{};
+
+    void update(uint64_t id, sys_milliseconds date)
+    {
+        last_id = std::max(last_id, id);
+        latest = std::max(latest, date);
+    }
+};
+
+/**
+ * The state of a community after a run. Slices before open_slice can no
+ * longer change: every session in them has ended more than six hours
+ * before the latest action seen. The actions of the sessions in the open
+ * slices are kept, so that those slices can be written again with the new
+ * actions added.
+ */
+struct sequence_state
+{
+    /// the months per time slice
+    int64_t time_slice = 0;
+    /// the seconds of idle time that end a session
+    int64_t session_gap = 0;
+    /// the layout of the slices (--dense-slices and --legacy-format),
+    /// which the open slices are written again in
+    bool dense_slices = false;
+    bool legacy_format = false;
+    time_span span;
+    table_watermark posts_rows;
+    table_watermark comments_rows;
+    table_watermark history_rows;
+    /// the first slice that may still change
+    uint64_t open_slice = 0;
+    /// the number of slices written
+    uint64_t num_slices = 0;
+    post_table posts;
+    /// every action of the sessions starting in open_slice or later
+    action_log open_actions;
+
+    /**
+     * Writes the state to filename, through a temporary file so that a
+     * failed run leaves the previous state in place.
+     */
+    void save(const std::string& filename) const
+    {
+        auto tmp = filename + ".tmp";
+        {
+            std::ofstream output{tmp, std::ios::binary};
+            meta::io::packed::write(output, uint64_t{magic});
+            meta::io::packed::write(output, time_slice);
+            meta::io::packed::write(output, session_gap);
+            meta::io::packed::write(output,
+                                    static_cast<uint8_t>(dense_slices));
+            meta::io::packed::write(output,
+                                    static_cast<uint8_t>(legacy_format));
+            write_time(output, span.earliest);
+            write_time(output, span.latest);
+            for (const auto* mark :
+                 {&posts_rows, &comments_rows, &history_rows})
+            {
+                meta::io::packed::write(output, mark->last_id);
+                write_time(output, mark->latest);
+            }
+            meta::io::packed::write(output, open_slice);
+            meta::io::packed::write(output, num_slices);
+            posts.save(output);
+            open_actions.save(output);
+            if (!output)
+                throw std::runtime_error{"failed to write " + tmp};
+        }
+        meta::filesystem::rename_file(tmp, filename);
+    }
+
+    static sequence_state load(const std::string& filename)
+    {
+        std::ifstream input{filename, std::ios::binary};
+        if (!input)
+            throw std::runtime_error{"failed to open " + filename};
+
+        uint64_t file_magic = 0;
+        meta::io::packed::read(input, file_magic);
+        if (file_magic != magic)
+            throw std::runtime_error{filename + " is not a sequence state"};
+
+        sequence_state state;
+        meta::io::packed::read(input, state.time_slice);
+        meta::io::packed::read(input, state.session_gap);
+        uint8_t flag = 0;
+        meta::io::packed::read(input, flag);
+        state.dense_slices = flag != 0;
+        meta::io::packed::read(input, flag);
+        state.legacy_format = flag != 0;
+        state.span.earliest = read_time(input);
+        state.span.latest = read_time(input);
+        for (auto* mark : {&state.posts_rows, &state.comments_rows,
+                           &state.history_rows})
+        {
+            meta::io::packed::read(input, mark->last_id);
+            mark->latest = read_time(input);
+        }
+        meta::io::packed::read(input, state.open_slice);
+        meta::io::packed::read(input, state.num_slices);
+        state.posts = post_table::load(input);
+        state.open_actions = action_log::load(input);
+        if (!input)
+            throw std::runtime_error{"truncated sequence state " + filename};
+        return state;
+    }
+
+  private:
+    /// "seqstat3"
+    static const uint64_t magic = 0x3374617473716573;
+
+    static void write_time(std::ostream& output, sys_milliseconds time)
+    {
+        meta::io::packed::write(
+            output, static_cast<int64_t>(time.time_since_epoch().count()));
+    }
+
+    static sys_milliseconds read_time(std::istream& input)
+    {
+        int64_t ms = 0;
+        meta::io::packed::read(input, ms);
+        return sys_milliseconds{std::chrono::milliseconds{ms}};
+    }
+};
+
+/**
+ * @return the path of the state extract-sequences keeps next to its
+ * output files with --incremental
+ */
+inline std::string state_filename(const std::string& prefix)
+{
+    return prefix + ".state";
+}
+
+#endif
@@ -0,0 +1,266 @@
+/**
+ * @file tables.h
+ * @author Chase Geigle
+ *
+ * Locating the tables of a community dump, which may be either a folder
+ * written by repack or the original .7z archive.
+ */
+
+#ifndef STACKEXCHANGE_TABLES_H_
+#define STACKEXCHANGE_TABLES_H_
+
+#include <memory>
+#include <string>
+
+#include "archive_file.h"
+#include "block_index.h"
+#include "columnar.h"
+#include "input.h"
+#include "parsing.h"
+#include "progress_report.h"
+#include "meta/io/filesystem.h"
+#include "meta/meta.h"
+
+/**
+ * Where one table lives: a file in a repacked folder, a folder of columns
+ * written by `repack --columnar`, or an entry of an archive.
+ */
+struct table_file
+{
+    /// the file (or column folder) on disk, empty if the table could not
+    /// be found
+    std::string path;
+    /// the entry within path if it is an archive, otherwise empty
+    std::string entry;
+    /// the number of bytes (or rows, for columns) progress is reported
+    /// against
+    uint64_t size = 0;
+    /// whether path is a column folder
+    bool columnar = false;
+
+    bool empty() const
+    {
+        return path.empty();
+    }
+};
+
+inline bool is_archive(const std::string& dump)
+{
+    return ends_with(dump, ".7z");
+}
+
+/**
+ * Finds the named table (e.g. "Posts") in a community dump. For a
+ * repacked folder this prefers columns, then the first of
+ * table_extensions() present; for an archive it lists the entries, which
+ * does not decompress them.
+ */
+inline table_file find_table(const std::string& dump, const std::string& table)
+{
+    if (is_archive(dump))
+    {
+        if (!meta::filesystem::file_exists(dump))
+            return {};
+
+        archive_file file{dump.c_str()};
+        auto name = table + ".xml";
+        auto entry = file.find_entry(name);
+        if (!entry)
+            return {};
+        return {dump, name, static_cast<uint64_t>(archive_entry_size(entry)),
+                false};
+    }
+
+    auto columns = column_folder(dump, table);
+    auto ids = column_filename(columns, "Id");
+    if (meta::filesystem::file_exists(ids))
+        return {columns, {},
+                meta::filesystem::file_size(ids) / sizeof(int32_t), true};
+
+    for (const auto& ext : table_extensions())
+    {
+        auto filename = dump + "/" + table + ext;
+        if (meta::filesystem::file_exists(filename))
+            return {filename, {}, meta::filesystem::file_size(filename),
+                    false};
+    }
+    return {};
+}
+
+/**
+ * Opens the bytes of an XML table found by find_table(). Progress is
+ * reported against table.size. See open_input() for the use of pool and
+ * ranges.
+ */
+inline std::unique_ptr<input_source>
+open_table(const table_file& table, progress_report progress,
+           meta::parallel::thread_pool* pool = nullptr,
+           const std::vector<byte_range>* ranges = nullptr)
+{
+    if (!table.entry.empty())
+    {
+        auto source = meta::make_unique<archive_source>(
+            table.path, table.entry, progress);
+        if (ranges)
+            return meta::make_unique<range_source>(std::move(source), *ranges);
+        return source;
+    }
+    return open_input(table.path, progress, pool, ranges);
+}
+
+/**
+ * Reads the rows of an XML table through a decompression pipeline.
+ */
+class xml_table_reader : public row_reader
+{
+  public:
+    xml_table_reader(const table_file& table, const attribute_schema& schema,
+                     progress_report progress,
+                     const parse_options& options,
+                     const std::vector<byte_range>* ranges = nullptr)
+        : source_{open_table(table, progress, options.pool, ranges)},
+          pipeline_{*source_},
+          reader_{make_row_reader(pipeline_, schema, options)}
+    {
+        // nothing
+    }
+
+    bool read_next() override
+    {
+        return reader_->read_next();
+    }
+
+    meta::util::optional<meta::util::string_view>
+    as_view(std::size_t field) const override
+    {
+        return reader_->as_view(field);
+    }
+
+    meta::util::optional<uint64_t> as_u64(std::size_t field) const override
+    {
+        return reader_->as_u64(field);
+    }
+
+    meta::util::optional<sys_milliseconds>
+    as_timestamp(std::size_t field) const override
+    {
+        return reader_->as_timestamp(field);
+    }
+
+  private:
+    std::unique_ptr<input_source> source_;
+    pipelined_source pipeline_;
+    std::unique_ptr<row_reader> reader_;
+};
+
+/**
+ * Skips the rows of another reader whose Id or CreationDate fall outside
+ * a row_range. Rows missing a constrained attribute are skipped too.
+ */
+class range_reader : public row_reader
+{
+  public:
+    range_reader(std::unique_ptr<row_reader> reader,
+                 const attribute_schema& schema, const row_range& range)
+        : reader_{std::move(reader)},
+          range_(range),
+          id_{schema.index("Id")},
+          date_{schema.index("CreationDate")}
+    {
+        if ((range_.min_id || range_.max_id) && id_ == schema.size())
+            throw std::invalid_argument{"an id range needs the Id field"};
+        if ((range_.min_date || range_.max_date) && date_ == schema.size())
+            throw std::invalid_argument{
+                "a date range needs the CreationDate field"};
+    }
+
+    bool read_next() override
+    {
+        while (reader_->read_next())
+        {
+            if (range_.min_id || range_.max_id)
+            {
+                auto id = reader_->as_u64(id_);
+                if (!id || !range_.contains_id(*id))
+                    continue;
+            }
+
+            if (range_.min_date || range_.max_date)
+            {
+                auto date = reader_->as_timestamp(date_);
+                if (!date || !range_.contains_date(*date))
+                    continue;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    meta::util::optional<meta::util::string_view>
+    as_view(std::size_t field) const override
+    {
+        return reader_->as_view(field);
+    }
+
+    meta::util::optional<uint64_t> as_u64(std::size_t field) const override
+    {
+        return reader_->as_u64(field);
+    }
+
+    meta::util::optional<sys_milliseconds>
+    as_timestamp(std::size_t field) const override
+    {
+        return reader_->as_timestamp(field);
+    }
+
+  private:
+    std::unique_ptr<row_reader> reader_;
+    row_range range_;
+    std::size_t id_;
+    std::size_t date_;
+};
+
+/**
+ * Opens the rows of a table found by find_table(), in whichever format it
+ * was found. Progress is reported against table.size.
+ */
+inline std::unique_ptr<row_reader>
+open_rows(const table_file& table, const attribute_schema& schema,
+          progress_report progress, const parse_options& options)
+{
+    if (table.columnar)
+        return meta::make_unique<column_reader>(table.path, schema, progress);
+    return meta::make_unique<xml_table_reader>(table, schema, progress,
+                                               options);
+}
+
+/**
+ * Opens only the rows of a table found by find_table() whose Id and
+ * CreationDate fall within range; the schema must include whichever of
+ * the two the range constrains. If repack wrote a block index for the
+ * table, only the blocks that can hold such rows are read (and, for a
+ * multi-block xz file or uncompressed XML, decompressed); otherwise every
+ * row is scanned.
+ */
+inline std::unique_ptr<row_reader>
+open_rows(const table_file& table, const attribute_schema& schema,
+          const row_range& range, progress_report progress,
+          const parse_options& options)
+{
+    std::unique_ptr<row_reader> reader;
+    auto index = index_filename(table.path);
+    if (!table.columnar && table.entry.empty()
+        && meta::filesystem::file_exists(index))
+    {
+        auto ranges = block_index::load(index).select(range);
+        reader = meta::make_unique<xml_table_reader>(table, schema, progress,
+                                                     options, &ranges);
+    }
+    else
+    {
+        reader = open_rows(table, schema, progress, options);
+    }
+    return meta::make_unique<range_reader>(std::move(reader), schema, range);
+}
+
+#endif
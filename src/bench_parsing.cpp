@@ -0,0 +1,151 @@
+/**
+ * @file bench_parsing.cpp
+ * @author Chase Geigle
+ *
+ * Micro-benchmark comparing the libxml2 xmlTextReaderGetAttribute path
+ * against the row scanner on a (repacked) StackExchange table, along with
+ * the scalar and vectorized byte locators the row scanner is built on.
+ */
+
+#include <iostream>
+
+#include "meta/io/filesystem.h"
+#include "meta/logging/logger.h"
+#include "meta/util/time.h"
+#include "parsing.h"
+
+using namespace meta;
+
+void report(const std::string& name, std::chrono::milliseconds time,
+            uint64_t bytes)
+{
+    auto secs = time.count() / 1000.0;
+    LOG(info) << name << ": " << secs << "s ("
+              << (secs > 0 ? bytes / secs / 1024 / 1024 : 0) << " MB/s)"
+              << ENDLG;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " table.xml{,.zst,.xz} attribute..." << std::endl;
+        std::cerr << "\te.g. " << argv[0]
+                  << " Posts.xml.xz Id PostTypeId CreationDate OwnerUserId"
+                  << std::endl;
+        return 1;
+    }
+
+    logging::set_cerr_logging();
+
+    std::string filename{argv[1]};
+    std::vector<std::string> names{argv + 2, argv + argc};
+    attribute_schema schema{{names.begin(), names.end()}};
+    auto filesize = filesystem::file_size(filename);
+
+    // decompression alone, as a baseline for the two parsers below
+    std::string sample;
+    uint64_t bytes = 0;
+    auto time = common::time([&]() {
+        printing::progress progress{" > Decompressing: ", filesize};
+        auto input = open_input(filename, progress);
+        std::vector<char> buffer(1024 * 1024);
+        while (auto num_read = input->read(buffer.data(), buffer.size()))
+        {
+            bytes += num_read;
+
+            // keep the first 256MB around for the locator benchmark
+            if (sample.size() < 256 * 1024 * 1024)
+                sample.append(buffer.data(), num_read);
+        }
+    });
+    report("decompression only", time, bytes);
+
+    uint64_t libxml_found = 0;
+    time = common::time([&]() {
+        printing::progress progress{" > libxml2: ", filesize};
+        auto input = open_input(filename, progress);
+        xml_text_reader reader{*input};
+        while (reader.read_next())
+        {
+            if (reader.node_name() != "row")
+                continue;
+            for (const auto& name : names)
+            {
+                if (auto attr = reader.attribute(name.c_str()))
+                    libxml_found += attr->sv().size();
+            }
+        }
+    });
+    report("xmlTextReaderGetAttribute", time, bytes);
+
+    uint64_t scanner_found = 0;
+    auto scan = [&](input_source& source) {
+        scanner_found = 0;
+        row_scanner reader{source, schema};
+        while (reader.read_next())
+        {
+            for (std::size_t field = 0; field < schema.size(); ++field)
+            {
+                if (auto attr = reader.as_view(field))
+                    scanner_found += attr->size();
+            }
+        }
+    };
+
+    time = common::time([&]() {
+        printing::progress progress{" > row_scanner: ", filesize};
+        auto input = open_input(filename, progress);
+        scan(*input);
+    });
+    report("row_scanner", time, bytes);
+
+    time = common::time([&]() {
+        printing::progress progress{" > row_scanner (pipelined): ", filesize};
+        auto input = open_input(filename, progress);
+        pipelined_source pipeline{*input};
+        scan(pipeline);
+    });
+    report("row_scanner (pipelined)", time, bytes);
+
+    if (libxml_found != scanner_found)
+    {
+        LOG(warning) << "Attribute bytes differ: " << libxml_found
+                     << " (libxml2) vs " << scanner_found << " (row_scanner)"
+                     << ENDLG;
+    }
+
+    auto first = sample.data();
+    auto last = sample.data() + sample.size();
+    uint64_t count = 0;
+    auto locate = [&](const char* (*find)(const char*, const char*)) {
+        count = 0;
+        return common::time([&]() {
+            for (auto pos = find(first, last); pos != last;
+                 pos = find(pos + 1, last))
+                ++count;
+        });
+    };
+
+    // find_byte_scalar is memchr, which glibc vectorizes itself, so the
+    // plain loop is the baseline the vector locators are measured against
+    report("find '\"' (byte loop)", locate([](const char* f, const char* l) {
+               while (f != l && *f != '"')
+                   ++f;
+               return f;
+           }),
+           sample.size());
+    report("find '\"' (memchr)", locate([](const char* f, const char* l) {
+               return find_byte_scalar(f, l, '"');
+           }),
+           sample.size());
+    report("find '\"' (vector)", locate([](const char* f, const char* l) {
+               return find_byte(f, l, '"');
+           }),
+           sample.size());
+    report("find markup (scalar)", locate(find_markup_scalar), sample.size());
+    report("find markup (vector)", locate(find_markup), sample.size());
+
+    return 0;
+}
@@ -14,6 +14,8 @@
 #include "meta/sequence/hmm/hmm.h"
 #include "meta/sequence/hmm/sequence_observations.h"
 
+#include "sequence_file.h"
+
 using namespace meta;
 
 int main(int argc, char** argv)
@@ -40,11 +42,20 @@ int main(int argc, char** argv)
     logging::set_cerr_logging();
 
     uint64_t num_states = std::stoull(argv[2]);
-    std::ifstream input{argv[1], std::ios::binary};
 
     LOG(info) << "Reading training data..." << ENDLG;
-    training_data_type training;
-    io::packed::read(input, training);
+    sequence_file sequences{argv[1]};
+    training_data_type training(sequences.num_users());
+    for (std::size_t user = 0; user < training.size(); ++user)
+    {
+        for (std::size_t s = 0; s < sequences.num_sessions(user); ++s)
+        {
+            auto session = sequences.session(user, s);
+            training[user].emplace_back();
+            for (const auto& type : session)
+                training[user].back().emplace_back(static_cast<uint8_t>(type));
+        }
+    }
 
     std::mt19937 rng{47};
 
@@ -17,6 +17,7 @@
 
 #include "actions.h"
 #include "cpptoml.h"
+#include "sequence_file.h"
 #include "meta/io/filesystem.h"
 #include "meta/logging/logger.h"
 #include "meta/math/fastapprox.h"
@@ -287,10 +288,6 @@ int main(int argc, char** argv)
     using dm_sequences_type = dm_mixture_model::sequences_type;
     using dm_session_type = dm_mixture_model::session_type;
 
-    using network_session_type = std::vector<action_type>;
-    using network_sequence_type = std::vector<network_session_type>;
-    using network_sequences_type = std::vector<network_sequence_type>;
-
     logging::set_cerr_logging();
 
     // set up options for the model
@@ -319,30 +316,32 @@ int main(int argc, char** argv)
             return 1;
         }
 
-        std::ifstream input{argv[a], std::ios::binary};
-
         // need to convert ordered sequences -> histograms
         // could write a separate extractor program for this, but why bother
-        network_sequences_type sequences;
-        auto bytes = io::packed::read(input, sequences);
-        if (bytes == 0 || !input)
+        std::unique_ptr<sequence_file> sequences;
+        try
+        {
+            sequences = make_unique<sequence_file>(argv[a]);
+        }
+        catch (const std::exception& ex)
         {
-            LOG(fatal) << "Failed to read file " << argv[a] << ENDLG;
+            LOG(fatal) << "Failed to read file " << argv[a] << ": "
+                       << ex.what() << ENDLG;
             return 1;
         }
 
         dm_sequences_type network;
-        for (const auto& user : sequences)
+        network.reserve(sequences->num_sessions());
+        for (std::size_t user = 0; user < sequences->num_users(); ++user)
         {
-            for (const auto& session : user)
+            for (std::size_t s = 0; s < sequences->num_sessions(user); ++s)
             {
                 dm_session_type dm_session;
-                for (const auto& action : session)
+                for (const auto& action : sequences->session(user, s))
                     dm_session[action] += 1;
                 network.emplace_back(dm_session);
             }
         }
-        network.shrink_to_fit();
 
         total_sessions += network.size();
         training.emplace_back(std::move(network));
@@ -11,11 +11,11 @@
 
 #include "date.h"
 #include "parsing.h"
+#include "tables.h"
 
 #include "meta/hashing/probe_map.h"
 #include "meta/io/filesystem.h"
 #include "meta/io/packed.h"
-#include "meta/io/xzstream.h"
 #include "meta/logging/logger.h"
 #include "meta/parallel/algorithm.h"
 #include "meta/stats/running_stats.h"
@@ -29,34 +29,26 @@ using namespace meta;
 
 time_span extract_comments(const std::string& folder)
 {
-    auto filename = folder + "/Comments.xml.xz";
+    auto table = find_table(folder, "Comments");
 
-    printing::progress progress{" > Extracting Comments: ",
-                                filesystem::file_size(filename)};
+    printing::progress progress{" > Extracting Comments: ", table.size};
 
-    io::xzifstream input{filename};
-    xml_text_reader reader{input, progress};
+    static const auto schema = comments_table::schema().project(
+        {comments_table::PostId, comments_table::CreationDate});
+
+    auto reader = open_rows(table, schema, progress, {});
 
     util::optional<time_span> span;
     uint64_t num_actions = 0;
-    while (reader.read_next())
+    while (reader->read_next())
     {
-        auto node_name = reader.node_name();
-
-        if (node_name == "comments")
-            continue;
-
-        if (node_name != "row")
-            throw std::runtime_error{"unrecognized XML entity "
-                                     + node_name.to_string()};
-
-        auto pid = reader.attribute("PostId");
-        auto dte = reader.attribute("CreationDate");
+        auto pid = reader->as_u64(comments_table::PostId);
+        auto dte = reader->as_timestamp(comments_table::CreationDate);
 
         if (!pid || !dte)
             continue;
 
-        auto timestamp = parse_date(dte->to_string());
+        auto timestamp = *dte;
         if (!span)
             span = time_span{timestamp, timestamp};
         else
@@ -71,14 +63,13 @@ time_span extract_comments(const std::string& folder)
 
 struct post_info
 {
-    post_info(const std::string& date)
-        : timestamp{parse_date(date)}
+    post_info(sys_milliseconds date) : timestamp{date}
     {
         // nothing
     }
 
-    post_info(const std::string& date, post_id pid)
-        : timestamp{parse_date(date)}, parent{pid}
+    post_info(sys_milliseconds date, post_id pid)
+        : timestamp{date}, parent{pid}
     {
         // nothing
     }
@@ -99,47 +90,40 @@ extract_posts(const std::string& folder, std::vector<post_id>& sorted_posts)
 {
     hashing::probe_map<post_id, post_info> post_map;
 
-    auto filename = folder + "/Posts.xml.xz";
+    auto table = find_table(folder, "Posts");
 
-    printing::progress progress{" > Extracting Posts: ",
-                                filesystem::file_size(filename)};
+    printing::progress progress{" > Extracting Posts: ", table.size};
 
-    io::xzifstream input{filename};
-    xml_text_reader reader{input, progress};
+    static const auto schema = posts_table::schema().project(
+        {posts_table::Id, posts_table::PostTypeId, posts_table::ParentId,
+         posts_table::AcceptedAnswerId, posts_table::CreationDate});
+
+    auto reader = open_rows(table, schema, progress, {});
 
     util::optional<time_span> span;
     uint64_t num_actions = 0;
-    while (reader.read_next())
+    while (reader->read_next())
     {
-        auto node_name = reader.node_name();
-
-        if (node_name == "posts")
-            continue;
-
-        if (node_name != "row")
-            throw std::runtime_error{"unrecognized XML entity "
-                                     + node_name.to_string()};
-
-        auto post_type = reader.attribute("PostTypeId");
-        auto date = reader.attribute("CreationDate");
-        auto id = reader.attribute("Id");
+        auto post_type = reader->as_u64(posts_table::PostTypeId);
+        auto date = reader->as_timestamp(posts_table::CreationDate);
+        auto id = reader->as_u64(posts_table::Id);
 
         if (!post_type || !date)
             continue;
 
-        auto timestamp = parse_date(date->to_string());
+        auto timestamp = *date;
         if (!span)
             span = time_span{timestamp, timestamp};
         else
             span->update(timestamp);
 
-        post_id post{std::stoul(id->to_string())};
+        post_id post{*id};
 
-        auto parent_id = reader.attribute("ParentId");
+        auto parent_id = reader->as_u64(posts_table::ParentId);
         if (parent_id)
         {
-            post_id parent{std::stoul(parent_id->to_string())};
-            post_info pinfo{date->to_string(), parent};
+            post_id parent{*parent_id};
+            post_info pinfo{timestamp, parent};
             post_map.emplace(post, pinfo);
 
             // this is an answer, so update the first answer timestamp for
@@ -158,10 +142,9 @@ extract_posts(const std::string& folder, std::vector<post_id>& sorted_posts)
         }
         else
         {
-            post_info pinfo{date->to_string()};
-            if (auto aans_id = reader.attribute("AcceptedAnswerId"))
-                pinfo.accepted_answer
-                    = post_id{std::stoul(aans_id->to_string())};
+            post_info pinfo{timestamp};
+            if (auto aans_id = reader->as_u64(posts_table::AcceptedAnswerId))
+                pinfo.accepted_answer = post_id{*aans_id};
             post_map.emplace(post, pinfo);
         }
 
@@ -176,45 +159,39 @@ extract_posts(const std::string& folder, std::vector<post_id>& sorted_posts)
 template <class PostMap>
 time_span extract_post_history(const std::string& folder, PostMap& post_map)
 {
-    auto filename = folder + "/PostHistory.xml.xz";
+    auto table = find_table(folder, "PostHistory");
 
-    printing::progress progress{" > Extracting PostHistory: ",
-                                filesystem::file_size(filename)};
+    printing::progress progress{" > Extracting PostHistory: ", table.size};
 
-    io::xzifstream input{filename};
-    xml_text_reader reader{input, progress};
+    static const auto schema = post_history_table::schema().project(
+        {post_history_table::PostHistoryTypeId, post_history_table::PostId,
+         post_history_table::CreationDate});
+
+    auto reader = open_rows(table, schema, progress, {});
 
     util::optional<time_span> span;
     uint64_t num_actions = 0;
-    while (reader.read_next())
+    while (reader->read_next())
     {
-        auto node_name = reader.node_name();
-
-        if (node_name == "posthistory")
-            continue;
-
-        if (node_name != "row")
-            throw std::runtime_error{"unrecognized XML entity "
-                                     + node_name.to_string()};
-
-        auto type = reader.attribute("PostHistoryTypeId");
-        auto date = reader.attribute("CreationDate");
-        auto pid = reader.attribute("PostId");
+        auto type = reader->as_u64(post_history_table::PostHistoryTypeId);
+        auto date = reader->as_timestamp(post_history_table::CreationDate);
+        auto pid = reader->as_u64(post_history_table::PostId);
 
         if (!type || !date)
             continue;
 
-        auto timestamp = parse_date(date->to_string());
+        auto timestamp = *date;
         if (!span)
             span = time_span{timestamp, timestamp};
         else
             span->update(timestamp);
 
-        history_type_id type_num{
-            static_cast<uint32_t>(std::stoul(type->to_string()))};
-        post_id post{static_cast<uint32_t>(std::stoul(pid->to_string()))};
-
         // skip history items where we can't identify the post
+        if (!pid)
+            continue;
+
+        history_type_id type_num{static_cast<uint32_t>(*type)};
+        post_id post{static_cast<uint32_t>(*pid)};
         auto it = post_map.find(post);
         if (it == post_map.end())
             continue;
@@ -308,7 +285,8 @@ int main(int argc, char** argv)
     if (argc < 2)
     {
         std::cerr << "Usage: " << argv[0]
-                  << " [--time-slice=N] folder [output-file]" << std::endl;
+                  << " [--time-slice=N] folder|archive.7z [output-file]"
+                  << std::endl;
 
         std::cerr << "\t--time-slice=N\n"
                   << "\t\tCreate a separate health_info for every N months "
@@ -351,13 +329,16 @@ int main(int argc, char** argv)
     }
 
     const auto& folder = *folder_name_iter;
-    for (const auto& name :
-         {"Comments.xml.xz", "Posts.xml.xz", "PostHistory.xml.xz"})
+    for (const auto& name : {"Comments", "Posts", "PostHistory"})
     {
-        if (!filesystem::file_exists(folder + "/" + name))
+        if (find_table(folder, name).empty())
         {
-            std::cerr << "File " << folder << '/' << name << " does not exist"
-                      << std::endl;
+            if (is_archive(folder))
+                std::cerr << "Archive " << folder << " has no entry " << name
+                          << ".xml" << std::endl;
+            else
+                std::cerr << "Table " << folder << '/' << name
+                          << ".xml{,.zst,.xz} does not exist" << std::endl;
             return 1;
         }
     }
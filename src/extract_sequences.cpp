@@ -6,76 +6,90 @@
  * dump.
  */
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <unistd.h>
 
 #include "date.h"
 #include "parsing.h"
+#include "tables.h"
 
-#include "meta/hashing/probe_map.h"
 #include "meta/io/filesystem.h"
 #include "meta/io/packed.h"
-#include "meta/io/xzstream.h"
 #include "meta/logging/logger.h"
+#include "meta/parallel/thread_pool.h"
 #include "meta/stats/running_stats.h"
 #include "meta/util/array_view.h"
 #include "meta/util/identifiers.h"
 #include "meta/util/progress.h"
 
+#include "action_log.h"
 #include "actions.h"
+#include "post_table.h"
+#include "sequence_file.h"
+#include "sequence_state.h"
 
 using namespace meta;
 
-struct action
+/**
+ * Opens the rows of a table past a watermark, which for a table that has
+ * not been read before is all of them.
+ */
+std::unique_ptr<row_reader> open_new_rows(const table_file& table,
+                                          const attribute_schema& schema,
+                                          const table_watermark& mark,
+                                          progress_report progress,
+                                          const parse_options& options)
 {
-    action(action_type atype, const std::string& d)
-        : type{atype}, date{parse_date(d)}
-    {
-        // nothing
-    }
+    if (mark.last_id == 0)
+        return open_rows(table, schema, progress, options);
 
-    action_type type;
-    sys_milliseconds date;
-};
-
-bool operator<(const action& a, const action& b)
-{
-    return a.date < b.date;
+    row_range range;
+    range.min_id = mark.last_id + 1;
+    return open_rows(table, schema, range, progress, options);
 }
 
-template <class ActionMap, class PostMap>
-time_span extract_comments(const std::string& folder, ActionMap& actions,
-                           PostMap& post_map)
+util::optional<time_span> extract_comments(const std::string& folder,
+                                           action_log& actions,
+                                           const post_table& posts,
+                                           table_watermark& mark,
+                                           const parse_options& options,
+                                           combined_progress& progress)
 {
-    auto filename = folder + "/Comments.xml.xz";
+    auto table = find_table(folder, "Comments");
 
-    printing::progress progress{" > Extracting Comments: ",
-                                filesystem::file_size(filename)};
+    static const auto schema = comments_table::schema().project(
+        {comments_table::Id, comments_table::PostId, comments_table::UserId,
+         comments_table::CreationDate});
 
-    io::xzifstream input{filename};
-    xml_text_reader reader{input, progress};
+    auto reader
+        = open_new_rows(table, schema, mark, progress.part(), options);
 
     util::optional<time_span> span;
     uint64_t num_actions = 0;
-    while (reader.read_next())
+    while (reader->read_next())
     {
-        auto node_name = reader.node_name();
-
-        if (node_name == "comments")
-            continue;
-
-        if (node_name != "row")
-            throw std::runtime_error{"unrecognized XML entity "
-                                     + node_name.to_string()};
+        auto id = reader->as_u64(comments_table::Id);
+        auto pid = reader->as_u64(comments_table::PostId);
+        auto uid = reader->as_u64(comments_table::UserId);
+        auto dte = reader->as_timestamp(comments_table::CreationDate);
 
-        auto pid = reader.attribute("PostId");
-        auto uid = reader.attribute("UserId");
-        auto dte = reader.attribute("CreationDate");
+        if (id && dte)
+            mark.update(*id, *dte);
 
         if (!pid || !dte)
             continue;
 
-        auto timestamp = parse_date(dte->to_string());
+        auto timestamp = *dte;
         if (!span)
             span = time_span{timestamp, timestamp};
         else
@@ -84,79 +98,58 @@ time_span extract_comments(const std::string& folder, ActionMap& actions,
         if (!uid)
             continue;
 
-        post_id post{std::stoul(pid->to_string())};
-        user_id user{std::stoul(uid->to_string())};
+        post_id post{*pid};
+        user_id user{*uid};
 
         // skip comments where we either (a) can't find the parent or (b)
         // can't find the root question
         //
         // this could happen if the parent post(s) have no user id
         // specified and we thus dropped it during post extraction
-        auto type = comment_type(post, user, post_map);
+        auto type = posts.comment_type(post, user);
         if (!type)
             continue;
 
-        actions[user].emplace_back(*type, dte->to_string());
+        actions.append(user, timestamp, *type);
 
         ++num_actions;
     }
-    progress.end();
-    LOG(progress) << "\rFound " << num_actions << " comments\n" << ENDLG;
-    return *span;
+    progress.finished("Found " + std::to_string(num_actions) + " comments in "
+                      + folder);
+    return span;
 }
 
-struct post_info
+util::optional<time_span> extract_posts(const std::string& folder,
+                                        action_log& actions, post_table& posts,
+                                        table_watermark& mark,
+                                        const parse_options& options,
+                                        combined_progress& progress)
 {
-    post_info(user_id uid) : op{uid}
-    {
-        // nothing
-    }
-
-    post_info(user_id uid, post_id pid) : op{uid}, parent{pid}
-    {
-        // nothing
-    }
-
-    user_id op;
-    util::optional<post_id> parent;
-};
-
-template <class ActionMap>
-std::tuple<hashing::probe_map<post_id, post_info>, time_span>
-extract_posts(const std::string& folder, ActionMap& actions)
-{
-    hashing::probe_map<post_id, post_info> post_map;
-
-    auto filename = folder + "/Posts.xml.xz";
+    auto table = find_table(folder, "Posts");
 
-    printing::progress progress{" > Extracting Posts: ",
-                                filesystem::file_size(filename)};
+    static const auto schema = posts_table::schema().project(
+        {posts_table::Id, posts_table::PostTypeId, posts_table::ParentId,
+         posts_table::CreationDate, posts_table::OwnerUserId});
 
-    io::xzifstream input{filename};
-    xml_text_reader reader{input, progress};
+    auto reader
+        = open_new_rows(table, schema, mark, progress.part(), options);
 
     util::optional<time_span> span;
     uint64_t num_actions = 0;
-    while (reader.read_next())
+    while (reader->read_next())
     {
-        auto node_name = reader.node_name();
+        auto post_type = reader->as_u64(posts_table::PostTypeId);
+        auto date = reader->as_timestamp(posts_table::CreationDate);
+        auto uid = reader->as_u64(posts_table::OwnerUserId);
+        auto id = reader->as_u64(posts_table::Id);
 
-        if (node_name == "posts")
-            continue;
-
-        if (node_name != "row")
-            throw std::runtime_error{"unrecognized XML entity "
-                                     + node_name.to_string()};
-
-        auto post_type = reader.attribute("PostTypeId");
-        auto date = reader.attribute("CreationDate");
-        auto uid = reader.attribute("OwnerUserId");
-        auto id = reader.attribute("Id");
+        if (id && date)
+            mark.update(*id, *date);
 
         if (!post_type || !date)
             continue;
 
-        auto timestamp = parse_date(date->to_string());
+        auto timestamp = *date;
         if (!span)
             span = time_span{timestamp, timestamp};
         else
@@ -165,18 +158,18 @@ extract_posts(const std::string& folder, ActionMap& actions)
         if (!uid)
             continue;
 
-        user_id user{std::stoul(uid->to_string())};
-        post_id post{std::stoul(id->to_string())};
+        user_id user{*uid};
+        post_id post{*id};
 
         action_type type;
-        auto parent_id = reader.attribute("ParentId");
+        auto parent_id = reader->as_u64(posts_table::ParentId);
         if (parent_id)
         {
-            post_id parent{std::stoul(parent_id->to_string())};
-            post_map.emplace(post, post_info{user, parent});
+            post_id parent{*parent_id};
+            posts.add_answer(post, user, parent);
 
             // this is an answer. Was the question our own?
-            auto ptype = content(parent, user, post_map);
+            auto ptype = posts.content(parent, user);
 
             // skip answers to questions we weren't able to attach to a
             // user id
@@ -188,70 +181,68 @@ extract_posts(const std::string& folder, ActionMap& actions)
         }
         else
         {
-            post_map.emplace(post, user);
+            posts.add_question(post, user);
             type = action_type::QUESTION;
         }
 
-        actions[user].emplace_back(type, date->to_string());
+        actions.append(user, timestamp, type);
         ++num_actions;
     }
-    progress.end();
-    LOG(progress) << "\rFound " << num_actions << " posts\n" << ENDLG;
-    return std::tie(post_map, *span);
+    progress.finished("Found " + std::to_string(num_actions) + " posts in "
+                      + folder);
+    posts.link();
+    return span;
 }
 
-template <class ActionMap, class PostMap>
-time_span extract_post_history(const std::string& folder, ActionMap& actions,
-                          PostMap& post_map)
+util::optional<time_span> extract_post_history(const std::string& folder,
+                                               action_log& actions,
+                                               const post_table& posts,
+                                               table_watermark& mark,
+                                               const parse_options& options,
+                                               combined_progress& progress)
 {
-    auto filename = folder + "/PostHistory.xml.xz";
+    auto table = find_table(folder, "PostHistory");
 
-    printing::progress progress{" > Extracting PostHistory: ",
-                                filesystem::file_size(filename)};
+    // UserId precedes the (huge) Text attribute, so rows can be cut short
+    static const auto schema = post_history_table::schema().project(
+        {post_history_table::Id, post_history_table::PostHistoryTypeId,
+         post_history_table::PostId, post_history_table::UserId,
+         post_history_table::CreationDate});
 
-    io::xzifstream input{filename};
-    xml_text_reader reader{input, progress};
+    auto reader
+        = open_new_rows(table, schema, mark, progress.part(), options);
 
     util::optional<time_span> span;
     uint64_t num_actions = 0;
-    while (reader.read_next())
+    while (reader->read_next())
     {
-        auto node_name = reader.node_name();
-
-        if (node_name == "posthistory")
-            continue;
+        auto uid = reader->as_u64(post_history_table::UserId);
+        auto type = reader->as_u64(post_history_table::PostHistoryTypeId);
+        auto date = reader->as_timestamp(post_history_table::CreationDate);
+        auto pid = reader->as_u64(post_history_table::PostId);
+        auto id = reader->as_u64(post_history_table::Id);
 
-        if (node_name != "row")
-            throw std::runtime_error{"unrecognized XML entity "
-                                     + node_name.to_string()};
-
-        auto uid = reader.attribute("UserId");
-        auto type = reader.attribute("PostHistoryTypeId");
-        auto date = reader.attribute("CreationDate");
-        auto pid = reader.attribute("PostId");
+        if (id && date)
+            mark.update(*id, *date);
 
         if (!type || !date)
             continue;
 
-        auto timestamp = parse_date(date->to_string());
+        auto timestamp = *date;
         if (!span)
             span = time_span{timestamp, timestamp};
         else
             span->update(timestamp);
 
-        if (!uid)
+        if (!uid || !pid)
             continue;
 
-        user_id user{std::stoul(uid->to_string())};
-        history_type_id type_num{std::stoul(type->to_string())};
-        post_id post{std::stoul(pid->to_string())};
+        user_id user{*uid};
+        history_type_id type_num{*type};
+        post_id post{*pid};
 
         // skip history items where we can't identify the post
-        auto it = post_map.find(post);
-        if (it == post_map.end())
-            continue;
-
-        auto ctype = content(post, user, post_map);
+        auto ctype = posts.content(post, user);
         if (!ctype)
             continue;
 
@@ -259,12 +250,12 @@ time_span extract_post_history(const std::string& folder, ActionMap& actions,
         if (atype == action_type::INIT)
             continue;
 
-        actions[user].emplace_back(atype, date->to_string());
+        actions.append(user, timestamp, atype);
         ++num_actions;
     }
-    progress.end();
-    LOG(progress) << "\rFound " << num_actions << " history actions\n" << ENDLG;
-    return *span;
+    progress.finished("Found " + std::to_string(num_actions)
+                      + " history actions in " + folder);
+    return span;
 }
 
 struct sequence_stats
@@ -274,83 +265,996 @@ struct sequence_stats
     stats::running_stats gap_length;
 };
 
-using session_actions = util::array_view<const action>;
-using session_list = std::vector<session_actions>;
-using slice = std::vector<session_list>;
+using session_actions = util::array_view<const action_type>;
 
-void partition_sequences(std::vector<slice>& slices,
-                         const std::vector<action>& actions,
-                         sequence_stats& stats, sys_milliseconds birth,
-                         date::months step_size)
+/**
+ * Writes one set of time slice files ("<prefix>.NNN.bin"), a user at a
+ * time, in the version 2 layout of sequence_file.h (or, for legacy
+ * output, as the number of users in the slice followed by each user's
+ * sessions as nested io::packed vectors, which only line up across slices
+ * when they are dense). The tables are filled in as
+ * soon as a user is complete, and gathered in part files for each slice,
+ * so that no slice is ever held in memory.
+ *
+ * A user has an entry in only the slices they have sessions in, unless the
+ * slices are dense, in which case every user has an (empty, if need be)
+ * entry in every slice from the first up to the last they have sessions
+ * in, as the original files did.
+ */
+class slice_writer
 {
-    using namespace std::chrono;
-    const action* begin = &actions[0];
-    const action* last = begin;
+  public:
+    /// the size past which a slice's tables are moved to its part files,
+    /// which bounds the memory each slice holds on to
+    static const uint64_t flush_size = 256 * 1024;
+
+    slice_writer(std::string prefix, std::size_t first_slice,
+                 std::size_t num_slices, bool dense, bool legacy)
+        : prefix_{std::move(prefix)},
+          first_slice_{first_slice},
+          dense_{dense},
+          legacy_{legacy},
+          slices_(num_slices)
+    {
+        // left behind by a run that failed
+        for (auto slice = first_slice_; slice < num_slices; ++slice)
+        {
+            for (std::size_t table = 0; table < num_tables; ++table)
+                filesystem::delete_file(part_filename(slice, table));
+        }
+    }
+
+    /**
+     * Adds a session of the current user. A user's sessions must be added
+     * in order of slice.
+     */
+    void add_session(std::size_t slice, session_actions session)
+    {
+        sessions_.emplace_back(slice, session);
+    }
 
-    std::vector<util::array_view<const action>> sequences;
-    for (const auto& act : actions)
+    /**
+     * Completes the current user. Users must be completed in order of id.
+     */
+    void end_user(user_id user)
     {
-        auto gap = act.date - last->date;
-        if (gap > hours{6})
+        if (sessions_.empty())
+            return;
+
+        auto it = sessions_.begin();
+        auto slice = dense_ ? first_slice_ : it->first;
+        while (it != sessions_.end())
         {
-            last = &act;
-            sequences.emplace_back(begin, last);
-            begin = last;
+            auto end = std::find_if(it, sessions_.end(),
+                                    [&](const std::pair<std::size_t,
+                                                        session_actions>& s) {
+                                        return s.first != slice;
+                                    });
+
+            auto& part = slices_.at(slice);
+            if (legacy_)
+                write_legacy(part, it, end);
+            else
+                write(part, user, it, end);
+            it = end;
+            ++part.num_users;
+
+            if (part.buffered() > flush_size)
+                flush(slice);
+
+            if (it != sessions_.end())
+                slice = dense_ ? slice + 1 : it->first;
         }
-        else
+        sessions_.clear();
+    }
+
+    /**
+     * Writes out the slice files, from the first one on.
+     */
+    void finish()
+    {
+        for (auto slice = first_slice_; slice < slices_.size(); ++slice)
         {
-            if (&act != last)
+            flush(slice);
+
+            const auto& part = slices_[slice];
+            auto name = sequence_filename(prefix_, slice);
+            std::ofstream output{name, std::ios::binary};
+            if (legacy_)
+            {
+                io::packed::write(output, part.num_users);
+                append_part(output, slice, 0);
+            }
+            else
             {
-                stats.gap_length.add(duration_cast<minutes>(gap).count());
+                sequence_file_header header;
+                header.flags = dense_ ? sequence_file_header::dense_flag : 0;
+                header.slice = slice;
+                header.num_users = part.num_users;
+                header.num_sessions = part.num_sessions;
+                header.num_actions = part.num_actions;
+                write_fixed(output, header);
+
+                append_part(output, slice, 0);
+                write_fixed(output,
+                            sequence_user_record{0, part.num_sessions});
+                append_part(output, slice, 1);
+                write_fixed(output, part.num_actions);
+                append_part(output, slice, 2);
             }
-            last = &act;
+            if (!output)
+                throw std::runtime_error{"failed to write " + name};
+        }
+    }
+
+  private:
+    using session_iterator
+        = std::vector<std::pair<std::size_t, session_actions>>::iterator;
+
+    /// the user records, session offsets and actions of a version 2 file
+    static const std::size_t num_tables = 3;
+
+    /**
+     * The entries of a slice not yet written to its part files, and the
+     * totals so far.
+     */
+    struct slice_part
+    {
+        uint64_t num_users = 0;
+        uint64_t num_sessions = 0;
+        uint64_t num_actions = 0;
+        std::array<std::stringstream, num_tables> tables;
+
+        uint64_t buffered()
+        {
+            uint64_t size = 0;
+            for (auto& table : tables)
+                size += static_cast<uint64_t>(table.tellp());
+            return size;
+        }
+    };
+
+    template <class T>
+    static void write_fixed(std::ostream& output, const T& value)
+    {
+        output.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static void write(slice_part& part, user_id user, session_iterator it,
+                      session_iterator end)
+    {
+        write_fixed(part.tables[0],
+                    sequence_user_record{static_cast<uint64_t>(user),
+                                         part.num_sessions});
+        for (; it != end; ++it)
+        {
+            write_fixed(part.tables[1], part.num_actions);
+            part.tables[2].write(
+                reinterpret_cast<const char*>(it->second.begin()),
+                static_cast<std::streamsize>(it->second.size()));
+            part.num_actions += it->second.size();
+            ++part.num_sessions;
+        }
+    }
+
+    static void write_legacy(slice_part& part, session_iterator it,
+                             session_iterator end)
+    {
+        auto& buffer = part.tables[0];
+        io::packed::write(buffer, static_cast<uint64_t>(end - it));
+        for (; it != end; ++it)
+        {
+            io::packed::write(buffer, it->second.size());
+            for (const auto& type : it->second)
+                io::packed::write(buffer, type);
+        }
+    }
+
+    std::string part_filename(std::size_t slice, std::size_t table) const
+    {
+        return sequence_filename(prefix_, slice) + ".part"
+               + std::to_string(table);
+    }
+
+    void flush(std::size_t slice)
+    {
+        auto& part = slices_[slice];
+        for (std::size_t table = 0; table < num_tables; ++table)
+        {
+            auto& buffer = part.tables[table];
+            if (buffer.tellp() <= 0)
+                continue;
+
+            std::ofstream output{part_filename(slice, table),
+                                 std::ios::binary | std::ios::app};
+            output << buffer.rdbuf();
+            buffer.str({});
+            buffer.clear();
+        }
+    }
+
+    /**
+     * Copies a part file to the end of output, and removes it.
+     */
+    void append_part(std::ostream& output, std::size_t slice,
+                     std::size_t table) const
+    {
+        auto name = part_filename(slice, table);
+        if (!filesystem::file_exists(name))
+            return;
+        {
+            std::ifstream input{name, std::ios::binary};
+            output << input.rdbuf();
+        }
+        filesystem::delete_file(name);
+    }
+
+    std::string prefix_;
+    std::size_t first_slice_;
+    bool dense_;
+    bool legacy_;
+    std::vector<slice_part> slices_;
+    /// the sessions of the current user, with the slice each starts in
+    std::vector<std::pair<std::size_t, session_actions>> sessions_;
+};
+
+/**
+ * @return the time slice an action (in seconds since the epoch) falls in
+ */
+std::size_t slice_of(uint32_t time, sys_milliseconds birth,
+                     date::months step_size)
+{
+    auto secs = date::sys_seconds{std::chrono::seconds{time}};
+    return static_cast<std::size_t>((secs - birth) / step_size);
+}
+
+/**
+ * The idle time that ends a session, and what its output files are named
+ * after (nothing for the default).
+ */
+struct session_gap
+{
+    std::chrono::seconds length{std::chrono::hours{6}};
+    std::string label;
+};
+
+/**
+ * @return a session gap given as e.g. "90s", "30m", "6h" or "1d"
+ */
+session_gap parse_session_gap(const std::string& text)
+{
+    using namespace std::chrono;
+
+    std::size_t pos = 0;
+    auto count = std::stol(text, &pos);
+    auto unit = text.substr(pos);
+    if (count <= 0)
+        throw std::invalid_argument{"invalid session gap " + text};
+
+    session_gap gap;
+    gap.label = text;
+    if (unit == "s")
+        gap.length = seconds{count};
+    else if (unit == "m")
+        gap.length = minutes{count};
+    else if (unit == "h")
+        gap.length = hours{count};
+    else if (unit == "d")
+        gap.length = hours{24 * count};
+    else
+        throw std::invalid_argument{"invalid session gap " + text};
+    return gap;
+}
+
+/**
+ * @return the name of the file marking that every slice of a prefix has
+ * been written for a set of session gaps, e.g. "<prefix>.done" or
+ * "<prefix>.30m,6h.done"
+ */
+std::string completion_filename(const std::string& prefix,
+                                const std::vector<session_gap>& gaps)
+{
+    std::string labels;
+    for (const auto& gap : gaps)
+    {
+        if (gap.label.empty())
+            continue;
+        labels += labels.empty() ? "." : ",";
+        labels += gap.label;
+    }
+    return prefix + labels + ".done";
+}
+
+/**
+ * @return the index of the first action of each session among a user's
+ * actions (in seconds since the epoch, sorted), where sessions are split
+ * at gaps of more than max_gap
+ */
+std::vector<std::size_t> session_starts(const uint32_t* times,
+                                        std::size_t size,
+                                        std::chrono::seconds max_gap,
+                                        sequence_stats* stats = nullptr)
+{
+    using namespace std::chrono;
+
+    std::vector<std::size_t> starts{0};
+    for (std::size_t i = 1; i < size; ++i)
+    {
+        auto gap = seconds{times[i] - times[i - 1]};
+        if (gap > max_gap)
+            starts.push_back(i);
+        else if (stats)
+            stats->gap_length.add(duration_cast<minutes>(gap).count());
+    }
+    return starts;
+}
+
+/**
+ * Splits the actions of a user (by compacted id), given as parallel
+ * arrays of times (in seconds since the epoch) and types sorted by time,
+ * into sessions at gaps of more than max_gap, and adds each session to the
+ * time slice it starts in. Sessions starting before first_slice are added
+ * to it.
+ *
+ * @return the index of the first action of the user's last session
+ */
+std::size_t partition_sequences(slice_writer& slices, uint32_t user,
+                                const uint32_t* times,
+                                const action_type* types, std::size_t size,
+                                sequence_stats& stats, sys_milliseconds birth,
+                                date::months step_size,
+                                std::chrono::seconds max_gap,
+                                std::size_t first_slice = 0)
+{
+    auto starts = session_starts(times, size, max_gap, &stats);
+    auto last_start = starts.back();
+
+    stats.num_sequences.add(starts.size());
+    starts.push_back(size);
+
+    for (std::size_t i = 0; i + 1 < starts.size(); ++i)
+    {
+        auto slice = std::max(first_slice,
+                              slice_of(times[starts[i]], birth, step_size));
+        auto length = starts[i + 1] - starts[i];
+        stats.sequence_length.add(length);
+        slices.add_session(slice, {types + starts[i], length});
+    }
+    slices.end_user(expand_user_id(user));
+    return last_start;
+}
+
+/**
+ * Calls fn(user, times, types, size) with the actions of each user of a
+ * sorted log in turn.
+ */
+template <class Function>
+void for_each_user(const action_log& actions, Function&& fn)
+{
+    for (std::size_t first = 0, last = 0; first < actions.size(); first = last)
+    {
+        // each user's actions are a contiguous run of the sorted log
+        while (last < actions.size()
+               && actions.user(last) == actions.user(first))
+            ++last;
+        fn(actions.user(first), actions.times() + first,
+           actions.types() + first, last - first);
+    }
+}
+
+/**
+ * Calls fn(user, times, types, size) with the actions of each user in
+ * turn, merged from sorted runs.
+ */
+template <class Function>
+void for_each_user(const std::vector<const action_runs*>& runs, Function&& fn)
+{
+    // the current user's actions
+    std::vector<uint32_t> times;
+    std::vector<action_type> types;
+    uint32_t user = 0;
+    auto flush = [&]() {
+        fn(user, times.data(), types.data(), times.size());
+        times.clear();
+        types.clear();
+    };
+
+    action_runs::merge(runs,
+                       [&](uint32_t uid, uint32_t time, action_type type) {
+                           if (!times.empty() && uid != user)
+                               flush();
+                           user = uid;
+                           times.push_back(time);
+                           types.push_back(type);
+                       });
+    if (!times.empty())
+        flush();
+}
+
+struct extract_options
+{
+    date::months time_slice{std::numeric_limits<date::months::rep>::max()};
+    parse_options parse;
+    /// the memory to stay around, or 0 to keep everything in memory
+    uint64_t memory_limit = 0;
+    bool incremental = false;
+    /// whether every user has an entry in every slice up to their last
+    bool dense_slices = false;
+    /// whether to write the headerless files of earlier versions
+    bool legacy_format = false;
+    /// the gaps to split sessions at, each with its own set of output
+    /// files
+    std::vector<session_gap> session_gaps{session_gap{}};
+    /// the bar every pass reports to, shared by the communities of a
+    /// batch; without one, each pass draws its own
+    combined_progress* progress = nullptr;
+};
+
+/**
+ * The progress bar of the passes over some of the tables of a community:
+ * the batch's, if there is one, or else one of its own, which is ended
+ * once the passes are done.
+ */
+class pass_progress
+{
+  public:
+    pass_progress(const std::string& folder,
+                  std::initializer_list<const char*> tables,
+                  combined_progress* shared)
+        : bar_{shared}
+    {
+        if (bar_)
+            return;
+
+        std::string names;
+        uint64_t length = 0;
+        for (const auto& table : tables)
+        {
+            names += (names.empty() ? "" : " and ") + std::string{table};
+            length += find_table(folder, table).size;
+        }
+        own_ = meta::make_unique<combined_progress>(
+            " > Extracting " + names + ": ", length);
+        bar_ = own_.get();
+    }
+
+    ~pass_progress()
+    {
+        if (own_)
+            own_->end();
+    }
+
+    combined_progress& bar()
+    {
+        return *bar_;
+    }
+
+  private:
+    combined_progress* bar_;
+    std::unique_ptr<combined_progress> own_;
+};
+
+/**
+ * Extracts the sequences of one community into "<prefix>.NNN.bin" files,
+ * sorting its actions on pool.
+ *
+ * @return the exit status
+ */
+int extract_sequences(const std::string& folder, const std::string& prefix,
+                      const extract_options& options,
+                      parallel::thread_pool& pool)
+{
+    using namespace std::chrono;
+
+    for (const auto& name : {"Comments", "Posts", "PostHistory"})
+    {
+        if (find_table(folder, name).empty())
+        {
+            if (is_archive(folder))
+                std::cerr << "Archive " << folder << " has no entry " << name
+                          << ".xml" << std::endl;
+            else
+                std::cerr << "Table " << folder << '/' << name
+                          << ".xml{,.zst,.xz} does not exist" << std::endl;
+            return 1;
+        }
+    }
+
+    // only written once every slice has been, so that a run that fails
+    // part way is not taken for a finished one
+    auto done_file = completion_filename(prefix, options.session_gaps);
+    filesystem::delete_file(done_file);
+
+    auto state_file = state_filename(prefix);
+    sequence_state state;
+    auto resume = options.incremental && filesystem::file_exists(state_file);
+    if (resume)
+    {
+        state = sequence_state::load(state_file);
+        if (state.time_slice != options.time_slice.count()
+            || state.session_gap != options.session_gaps[0].length.count())
+        {
+            LOG(fatal) << state_file << " was written with a different "
+                                        "--time-slice or session gap"
+                       << ENDLG;
+            return 1;
+        }
+        if (state.dense_slices != options.dense_slices
+            || state.legacy_format != options.legacy_format)
+        {
+            LOG(fatal) << state_file << " was written with a different "
+                                        "--dense-slices or --legacy-format"
+                       << ENDLG;
+            return 1;
+        }
+        LOG(info) << "Resuming from " << state_file << " at slice "
+                  << state.open_slice << ENDLG;
+    }
+    state.time_slice = options.time_slice.count();
+    state.session_gap = options.session_gaps[0].length.count();
+    state.dense_slices = options.dense_slices;
+    state.legacy_format = options.legacy_format;
+
+    action_log actions;
+    action_log history;
+    action_runs action_spills{prefix + ".actions"};
+    action_runs history_spills{prefix + ".history"};
+    if (options.memory_limit)
+    {
+        // a quarter of the budget for the post table, and a quarter for
+        // each of the two logs filled at once
+        auto max_actions = options.memory_limit / 4 / action_log::sort_bytes;
+        actions.spill_to(action_spills, max_actions, pool);
+        history.spill_to(history_spills, max_actions, pool);
+    }
+
+    // the sessions of the open slices are partitioned again along with the
+    // new actions
+    const auto& open_actions = state.open_actions;
+    for (std::size_t i = 0; i < open_actions.size(); ++i)
+        actions.append(open_actions.user(i), open_actions.times()[i],
+                       open_actions.types()[i]);
+    state.open_actions = action_log{};
+
+    util::optional<time_span> span;
+    if (resume)
+        span = state.span;
+    auto update_span = [&](const util::optional<time_span>& other) {
+        if (!other)
+            return;
+        if (!span)
+            span = other;
+        else
+            span->update(*other);
+    };
+
+    {
+        auto& posts = state.posts;
+        {
+            pass_progress progress{folder, {"Posts"}, options.progress};
+            update_span(extract_posts(folder, actions, posts,
+                                      state.posts_rows, options.parse,
+                                      progress.bar()));
         }
+
+        if (options.memory_limit && posts.bytes() > options.memory_limit / 4)
+        {
+            LOG(info) << "Mapping the post table from disk" << ENDLG;
+            posts.map_to(prefix + ".posts");
+        }
+
+        // the Comments and PostHistory passes only read posts, so they
+        // run side by side (sharing one progress bar), each collecting its
+        // own actions; the history actions are appended before sorting
+        pass_progress progress{folder, {"Comments", "PostHistory"},
+                               options.progress};
+        auto history_span = std::async(std::launch::async, [&]() {
+            return extract_post_history(folder, history, posts,
+                                        state.history_rows, options.parse,
+                                        progress.bar());
+        });
+
+        update_span(extract_comments(folder, actions, posts,
+                                     state.comments_rows, options.parse,
+                                     progress.bar()));
+        update_span(history_span.get());
+    }
+
+    if (!span)
+    {
+        LOG(fatal) << "No actions found in " << folder << ENDLG;
+        return 1;
     }
-    sequences.emplace_back(begin, last + 1);
 
-    stats.num_sequences.add(sequences.size());
+    LOG(info) << "Time span: ["
+              << date::format("%Y-%m-%dT%H:%M:%S", span->earliest) << ", "
+              << date::format("%Y-%m-%dT%H:%M:%S", span->latest) << "]" << ENDLG;
 
-    // partition sequences based on step size
-    std::size_t slice_num = 0;
-    auto it = sequences.begin();
-    auto end = sequences.end();
+    auto diff = span->latest - span->earliest;
+    auto num_files = static_cast<std::size_t>(diff / options.time_slice + 1);
+
+    // the slices before first_slice were written by an earlier run, and
+    // are final
+    std::size_t first_slice = resume ? state.open_slice : 0;
 
-    while (it != end)
+    // one set of slices (and statistics) for each session gap, all
+    // filled in the same pass over the actions
+    const auto& gaps = options.session_gaps;
+    std::deque<slice_writer> slices;
+    for (const auto& gap : gaps)
     {
-        auto slice_end = std::find_if(
-            it, end, [=](const util::array_view<const action>& sequence) {
-                return (sequence.begin()->date - birth) / step_size
-                       > static_cast<long>(slice_num);
-            });
+        auto name = gap.label.empty() ? prefix : prefix + "." + gap.label;
+        slices.emplace_back(name, first_slice, num_files,
+                            options.dense_slices, options.legacy_format);
+    }
+    std::vector<sequence_stats> stats(gaps.size());
 
-        auto& curr_slice = slices.at(slice_num);
-        curr_slice.emplace_back();
+    std::vector<const action_runs*> runs{&action_spills, &history_spills};
+    auto spilled = action_spills.size() + history_spills.size() > 0;
 
-        for (; it != slice_end; ++it)
+    if (!spilled)
+    {
+        actions.append(std::move(history));
+        LOG(info) << "Sorting " << actions.size() << " actions..." << ENDLG;
+        actions.sort(pool);
+    }
+    else
+    {
+        actions.spill();
+        history.spill();
+        LOG(info) << "Merging "
+                  << action_spills.num_actions()
+                         + history_spills.num_actions()
+                  << " actions from "
+                  << action_spills.size() + history_spills.size()
+                  << " sorted runs..." << ENDLG;
+    }
+
+    auto slice_start = [&](uint32_t time) {
+        return std::max(first_slice,
+                        slice_of(time, span->earliest, options.time_slice));
+    };
+
+    // a session that ends within a gap of the last row of every table
+    // may still be continued by the rows of the next dump (--incremental
+    // takes a single gap)
+    auto open_since = std::min({state.posts_rows.latest,
+                                state.comments_rows.latest,
+                                state.history_rows.latest})
+                      - gaps[0].length;
+    auto open_slice = num_files - 1;
+
+    auto partition = [&](uint32_t user, const uint32_t* times,
+                         const action_type* types, std::size_t size) {
+        for (std::size_t g = 0; g < gaps.size(); ++g)
         {
-            stats.sequence_length.add(it->size());
-            curr_slice.back().emplace_back(*it);
+            auto last = partition_sequences(
+                slices[g], user, times, types, size, stats[g], span->earliest,
+                options.time_slice, gaps[g].length, first_slice);
+            if (g == 0
+                && date::sys_seconds{seconds{times[size - 1]}} >= open_since)
+                open_slice = std::min(open_slice, slice_start(times[last]));
         }
-        it = slice_end;
-        ++slice_num;
+    };
+    if (spilled)
+        for_each_user(runs, partition);
+    else
+        for_each_user(actions, partition);
+
+    for (auto& writer : slices)
+        writer.finish();
+
+    if (options.incremental)
+    {
+        // keep every action of the sessions filed under the open slices
+        auto keep_open = [&](uint32_t user, const uint32_t* times,
+                             const action_type* types, std::size_t size) {
+            auto starts = session_starts(times, size, gaps[0].length);
+            auto it = std::find_if(
+                starts.begin(), starts.end(), [&](std::size_t start) {
+                    return slice_start(times[start]) >= open_slice;
+                });
+            if (it == starts.end())
+                return;
+            for (auto i = *it; i < size; ++i)
+                state.open_actions.append(user, times[i], types[i]);
+        };
+        if (spilled)
+            for_each_user(runs, keep_open);
+        else
+            for_each_user(actions, keep_open);
+
+        state.span = *span;
+        state.open_slice = open_slice;
+        state.num_slices = num_files;
+        state.save(state_file);
+        LOG(info) << "Saved " << state.open_actions.size()
+                  << " actions of the slices from " << open_slice
+                  << " on to " << state_file << ENDLG;
+    }
+    std::ofstream{done_file};
+
+    for (std::size_t g = 0; g < gaps.size(); ++g)
+    {
+        const auto& gap_stats = stats[g];
+        if (!gaps[g].label.empty())
+            LOG(info) << "Sessions split at gaps of " << gaps[g].label << ":"
+                      << ENDLG;
+        LOG(info) << "Sequence length: " << gap_stats.sequence_length.mean()
+                  << " +/- " << gap_stats.sequence_length.stddev() << ENDLG;
+        LOG(info) << "Gap length: " << gap_stats.gap_length.mean() << " +/- "
+                  << gap_stats.gap_length.stddev() << ENDLG;
+        LOG(info) << "Num sequences/user: " << gap_stats.num_sequences.mean()
+                  << " +/- " << gap_stats.num_sequences.stddev() << ENDLG;
+    }
+
+    return 0;
+}
+
+/**
+ * @return the short name of a community's folder or archive, e.g.
+ * "superuser" for "repacked/superuser.com/"
+ */
+std::string community_name(std::string dump)
+{
+    while (dump.size() > 1 && dump.back() == '/')
+        dump.pop_back();
+
+    auto name = dump.substr(dump.find_last_of('/') + 1);
+    for (const std::string suffix : {".7z", ".stackexchange.com", ".com"})
+    {
+        if (ends_with(name, suffix))
+            name.erase(name.size() - suffix.size());
     }
+    return name;
 }
 
-void write_slice(std::ostream& out, const slice& slice)
+bool has_tables(const std::string& dump)
 {
-    io::packed::write(out, slice.size());
-    for (const auto& sessions : slice)
+    for (const auto& name : {"Comments", "Posts", "PostHistory"})
     {
-        io::packed::write(out, sessions.size());
-        for (const auto& session : sessions)
+        if (find_table(dump, name).empty())
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @return the size of the tables of a community, in the units their
+ * progress is reported in
+ */
+uint64_t tables_size(const std::string& dump)
+{
+    uint64_t size = 0;
+    for (const auto& name : {"Comments", "Posts", "PostHistory"})
+        size += find_table(dump, name).size;
+    return size;
+}
+
+/**
+ * @return a generous guess at the memory extracting a community takes:
+ * every row is taken to be an action being sorted, every row of Posts an
+ * entry of the post table, and every slice that could have passed since
+ * StackOverflow started to hold a full buffer in each set of slices. The
+ * rows of an XML table are guessed at one per 128 bytes of it (compressed
+ * or not).
+ */
+uint64_t estimate_memory(const std::string& dump,
+                         const extract_options& options)
+{
+    uint64_t rows = 0;
+    uint64_t posts = 0;
+    for (const std::string name : {"Comments", "Posts", "PostHistory"})
+    {
+        auto table = find_table(dump, name);
+        auto num_rows = table.columnar ? table.size : table.size / 128;
+        rows += num_rows;
+        if (name == "Posts")
+            posts = num_rows;
+    }
+
+    using namespace std::chrono;
+    auto launch = date::sys_days{date::days{days_from_civil(2008, 7, 1)}};
+    auto age = duration_cast<date::months>(system_clock::now() - launch);
+    auto num_slices = static_cast<uint64_t>(age / options.time_slice) + 1;
+
+    return rows * action_log::sort_bytes + posts * post_table::entry_bytes()
+           + num_slices * options.session_gaps.size()
+                 * slice_writer::flush_size;
+}
+
+/**
+ * A community to extract as part of a batch.
+ */
+struct batch_job
+{
+    std::string dump;
+    std::string prefix;
+    /// the size of its tables, in the units progress is reported in
+    uint64_t size;
+    uint64_t memory;
+};
+
+/**
+ * Finds the communities of a batch. Each of dumps is either a community
+ * (a repacked folder or an archive) or a folder of them; meta sites are
+ * skipped, as are the entries of a folder that are not communities.
+ *
+ * @return the communities, the largest first
+ */
+std::vector<batch_job> find_communities(const std::vector<std::string>& dumps,
+                                        const std::string& output_dir,
+                                        const extract_options& options)
+{
+    std::vector<std::string> found;
+    for (const auto& dump : dumps)
+    {
+        if (has_tables(dump))
+        {
+            found.push_back(dump);
+            continue;
+        }
+
+        auto dir = opendir(dump.c_str());
+        if (!dir)
+            throw std::runtime_error{dump + " is neither a community nor a "
+                                            "folder of them"};
+        while (auto entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..")
+                continue;
+
+            auto path = dump + "/" + name;
+            if (has_tables(path))
+                found.push_back(path);
+        }
+        closedir(dir);
+    }
+
+    std::vector<batch_job> jobs;
+    for (const auto& dump : found)
+    {
+        auto name = community_name(dump);
+        if (name.compare(0, 5, "meta.") == 0)
         {
-            io::packed::write(out, session.size());
-            for (const auto& act : session)
+            LOG(info) << "Skipping " << dump << ENDLG;
+            continue;
+        }
+        jobs.push_back({dump, output_dir + "/" + name + "-sequences.bin",
+                        tables_size(dump), estimate_memory(dump, options)});
+    }
+
+    // starting the largest communities first keeps a single huge one from
+    // being the only job left running at the end
+    std::sort(jobs.begin(), jobs.end(),
+              [](const batch_job& a, const batch_job& b) {
+                  return a.memory > b.memory;
+              });
+    return jobs;
+}
+
+/**
+ * Admits the communities of a batch as long as the memory they are
+ * estimated to need fits in a budget. A community estimated to need more
+ * than the whole budget is given all of it, and so runs alone.
+ */
+class memory_admission
+{
+  public:
+    memory_admission(uint64_t budget) : budget_{budget}, available_{budget}
+    {
+        // nothing
+    }
+
+    /**
+     * Waits until the estimate fits in what is left of the budget.
+     *
+     * @return the memory reserved, to be given back with release()
+     */
+    uint64_t acquire(uint64_t estimate)
+    {
+        auto amount = std::min(estimate, budget_);
+        std::unique_lock<std::mutex> lock{mutex_};
+        available_changed_.wait(lock,
+                                [&]() { return available_ >= amount; });
+        available_ -= amount;
+        return amount;
+    }
+
+    void release(uint64_t amount)
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            available_ += amount;
+        }
+        available_changed_.notify_all();
+    }
+
+  private:
+    const uint64_t budget_;
+    uint64_t available_;
+    std::mutex mutex_;
+    std::condition_variable available_changed_;
+};
+
+/**
+ * Extracts the sequences of several communities on num_jobs threads,
+ * sharing pool between them. Each thread takes the largest community left
+ * (rather than stealing work from the others: a community is extracted by
+ * a single thread, whose parsing and sorting go to the shared pool). The
+ * passes over every community's tables report to a single progress bar.
+ *
+ * @return the exit status
+ */
+int extract_batch(const std::vector<batch_job>& all_jobs,
+                  std::size_t num_jobs, uint64_t memory_budget,
+                  const extract_options& options,
+                  parallel::thread_pool& pool)
+{
+    std::vector<batch_job> jobs;
+    uint64_t total_size = 0;
+    for (const auto& job : all_jobs)
+    {
+        if (!options.incremental
+            && filesystem::file_exists(
+                   completion_filename(job.prefix, options.session_gaps)))
+        {
+            LOG(info) << job.dump << " has already been extracted, skipping..."
+                      << ENDLG;
+            continue;
+        }
+        jobs.push_back(job);
+        total_size += job.size;
+    }
+
+    combined_progress progress{" > Extracting: ", total_size};
+    memory_admission admission{memory_budget};
+    std::atomic<std::size_t> next_job{0};
+    std::atomic<bool> failed{false};
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < std::min(num_jobs, jobs.size()); ++i)
+    {
+        workers.emplace_back([&]() {
+            for (auto idx = next_job++; idx < jobs.size(); idx = next_job++)
             {
-                io::packed::write(out, act.type);
+                const auto& job = jobs[idx];
+                auto reserved = admission.acquire(job.memory);
+                progress.finished("Extracting sequences from " + job.dump
+                                  + " into " + job.prefix + "...");
+
+                // with a limit, the community spills to stay within its
+                // share of it (which for a small one is no less than an
+                // even split, in case it was underestimated)
+                auto job_options = options;
+                job_options.progress = &progress;
+                if (options.memory_limit)
+                    job_options.memory_limit
+                        = std::max(reserved, memory_budget / num_jobs);
+
+                try
+                {
+                    if (extract_sequences(job.dump, job.prefix, job_options,
+                                          pool)
+                        != 0)
+                        failed = true;
+                }
+                catch (const std::exception& ex)
+                {
+                    LOG(error) << "Failed to extract " << job.dump << ": "
+                               << ex.what() << ENDLG;
+                    failed = true;
+                }
+                admission.release(reserved);
             }
-        }
+        });
     }
+
+    for (auto& worker : workers)
+        worker.join();
+    progress.end();
+    return failed ? 1 : 0;
 }
 
 int main(int argc, char** argv)
@@ -360,13 +1264,73 @@ int main(int argc, char** argv)
     if (argc < 2)
     {
         std::cerr << "Usage: " << argv[0]
-                  << " [--time-slice=N] folder [output-file]" << std::endl;
+                  << " [--time-slice=N] [--parse-threads=N] [--chunk-size=MB]"
+                     " [--memory-limit=MB] [--incremental]"
+                     " [--session-gaps=GAP[,GAP...]] [--dense-slices]"
+                     " [--legacy-format]"
+                     " folder|archive.7z [output-file]"
+                  << std::endl;
+        std::cerr << "       " << argv[0]
+                  << " [options] --batch=DIR [--jobs=N] folder|archive.7z..."
+                  << std::endl;
 
         std::cerr << "\t--time-slice=N\n"
                   << "\t\tCreate a separate sequence file for every N months "
                      "after network birth"
                   << std::endl;
 
+        std::cerr << "\t--parse-threads=N\n"
+                  << "\t\tParse each table in chunks on N threads"
+                  << std::endl;
+
+        std::cerr << "\t--chunk-size=MB\n"
+                  << "\t\tSize of the chunks parsed by each thread "
+                     "(default 16)"
+                  << std::endl;
+
+        std::cerr << "\t--memory-limit=MB\n"
+                  << "\t\tSpill sorted actions to temporary files next to "
+                     "the output (and map the post table from one) to stay "
+                     "around this much memory"
+                  << std::endl;
+
+        std::cerr << "\t--incremental\n"
+                  << "\t\tKeep the state of the run next to the output, "
+                     "and if it is there already, only read the rows added "
+                     "since and rewrite the slices that may have changed"
+                  << std::endl;
+
+        std::cerr << "\t--session-gaps=GAP[,GAP...]\n"
+                  << "\t\tSplit sessions at each of these gaps (e.g. "
+                     "30m,1h,6h,1d) in the same pass, writing the files for "
+                     "each to output-file.GAP.NNN.bin (default: 6h, to "
+                     "output-file.NNN.bin)"
+                  << std::endl;
+
+        std::cerr << "\t--dense-slices\n"
+                  << "\t\tGive every user an entry in every slice up to "
+                     "their last one, even if it has no sessions (the "
+                     "original layout)"
+                  << std::endl;
+
+        std::cerr << "\t--legacy-format\n"
+                  << "\t\tWrite the headerless files of earlier versions, "
+                     "without user ids, instead of the version 2 layout "
+                     "(implies --dense-slices)"
+                  << std::endl;
+
+        std::cerr << "\t--batch=DIR\n"
+                  << "\t\tExtract every community given (or found in a "
+                     "folder given) into DIR/<community>-sequences.bin, "
+                     "several at once, skipping those already extracted; "
+                     "--memory-limit is then shared by them"
+                  << std::endl;
+
+        std::cerr << "\t--jobs=N\n"
+                  << "\t\tNumber of communities extracted at once in a "
+                     "batch (default: one per thread)"
+                  << std::endl;
+
         std::cerr << "\toutput-file: defaults to \"sequences.bin\""
                   << std::endl;
         return 1;
@@ -390,87 +1354,154 @@ int main(int argc, char** argv)
               return arg.size() > 13 && arg.substr(0, 13) == "--time-slice=";
           });
 
-    date::months time_slice{std::numeric_limits<date::months::rep>::max()};
+    extract_options options;
     if (time_slice_iter == args.end())
     {
         LOG(info) << "Creating one output file" << ENDLG;
     }
     else
     {
-        time_slice = date::months{std::stoi(time_slice_iter->substr(13))};
+        options.time_slice
+            = date::months{std::stoi(time_slice_iter->substr(13))};
         LOG(info) << "Creating a separate output file for every "
-                  << time_slice.count() << " months since birth" << ENDLG;
+                  << options.time_slice.count() << " months since birth"
+                  << ENDLG;
     }
 
-    const auto& folder = *folder_name_iter;
-    for (const auto& name :
-         {"Comments.xml.xz", "Posts.xml.xz", "PostHistory.xml.xz"})
+    auto parse_threads_iter
+        = std::find_if(args.begin() + 1, args.end(), [](util::string_view arg) {
+              return arg.size() > 16 && arg.substr(0, 16) == "--parse-threads=";
+          });
+
+    auto chunk_size_iter
+        = std::find_if(args.begin() + 1, args.end(), [](util::string_view arg) {
+              return arg.size() > 13 && arg.substr(0, 13) == "--chunk-size=";
+          });
+
+    std::unique_ptr<parallel::thread_pool> pool;
+    if (parse_threads_iter != args.end())
     {
-        if (!filesystem::file_exists(folder + "/" + name))
+        auto num_threads = std::stoul(parse_threads_iter->substr(16));
+        if (num_threads < 1)
         {
-            std::cerr << "File " << folder << '/' << name << " does not exist"
-                      << std::endl;
+            LOG(fatal) << "--parse-threads must be at least 1" << ENDLG;
             return 1;
         }
+        pool = make_unique<parallel::thread_pool>(num_threads);
+        options.parse.pool = pool.get();
+        LOG(info) << "Parsing tables on " << pool->size() << " threads"
+                  << ENDLG;
     }
 
-    hashing::probe_map<user_id, std::vector<action>> user_map;
-    util::optional<time_span> span;
+    if (chunk_size_iter != args.end())
     {
-        auto post_map_and_span = extract_posts(folder, user_map);
-        auto& post_map = std::get<0>(post_map_and_span);
-        span = std::get<1>(post_map_and_span);
-
-        auto comment_span = extract_comments(folder, user_map, post_map);
-        span->update(comment_span);
-
-        auto history_span = extract_post_history(folder, user_map, post_map);
-        span->update(history_span);
+        auto chunk_size = std::stoul(chunk_size_iter->substr(13));
+        if (chunk_size < 1)
+        {
+            LOG(fatal) << "--chunk-size must be at least 1" << ENDLG;
+            return 1;
+        }
+        options.parse.chunk_size = chunk_size * 1024 * 1024;
     }
 
-    auto actions = std::move(user_map).extract();
-    using value_type = decltype(actions)::value_type;
-    std::sort(actions.begin(), actions.end(),
-              [](const value_type& a, const value_type& b) {
-                  return a.first < b.first;
-              });
-
-    LOG(info) << "Sorting sequences..." << ENDLG;
-    for (auto& pr : actions)
-        std::sort(pr.second.begin(), pr.second.end());
-    LOG(info) << "Time span: ["
-              << date::format("%Y-%m-%dT%H:%M:%S", span->earliest) << ", "
-              << date::format("%Y-%m-%dT%H:%M:%S", span->latest) << "]" << ENDLG;
-
-    auto diff = span->latest - span->earliest;
-    auto num_files = static_cast<std::size_t>(diff / time_slice + 1);
+    auto memory_limit_iter
+        = std::find_if(args.begin() + 1, args.end(), [](util::string_view arg) {
+              return arg.size() > 15 && arg.substr(0, 15) == "--memory-limit=";
+          });
 
-    std::vector<slice> slices(num_files);
-    sequence_stats stats;
-    for (const auto& pr : actions)
+    if (memory_limit_iter != args.end())
     {
-        partition_sequences(slices, pr.second, stats, span->earliest, time_slice);
+        options.memory_limit
+            = std::stoull(memory_limit_iter->substr(15)) * 1024 * 1024;
+        LOG(info) << "Limiting memory to " << options.memory_limit / 1024 / 1024
+                  << " MB" << ENDLG;
     }
 
-    for (std::size_t i = 0; i < num_files; ++i)
+    options.incremental
+        = std::find(args.begin() + 1, args.end(), "--incremental")
+          != args.end();
+    options.dense_slices
+        = std::find(args.begin() + 1, args.end(), "--dense-slices")
+          != args.end();
+    options.legacy_format
+        = std::find(args.begin() + 1, args.end(), "--legacy-format")
+          != args.end();
+    // legacy files have no user ids, so a user is only identified by their
+    // position, which is the same across slices only when they are dense
+    if (options.legacy_format)
+        options.dense_slices = true;
+
+    auto session_gaps_iter
+        = std::find_if(args.begin() + 1, args.end(), [](util::string_view arg) {
+              return arg.size() > 15 && arg.substr(0, 15) == "--session-gaps=";
+          });
+
+    if (session_gaps_iter != args.end())
     {
-        std::stringstream filename;
-        if (argc < 2)
-            filename << "sequences";
-        else
-            filename << args.back();
-        filename << "." << std::setw(3) << std::setfill('0') << i << ".bin";
-        std::ofstream output{filename.str(), std::ios::binary};
+        options.session_gaps.clear();
+        std::stringstream gaps{session_gaps_iter->substr(15)};
+        std::string gap;
+        try
+        {
+            while (std::getline(gaps, gap, ','))
+                options.session_gaps.push_back(parse_session_gap(gap));
+        }
+        catch (const std::exception&)
+        {
+            LOG(fatal) << "Invalid session gap " << gap << ENDLG;
+            return 1;
+        }
 
-        write_slice(output, slices.at(i));
+        if (options.session_gaps.empty()
+            || (options.incremental && options.session_gaps.size() > 1))
+        {
+            LOG(fatal) << "--session-gaps needs one gap, or exactly one with "
+                          "--incremental"
+                       << ENDLG;
+            return 1;
+        }
     }
 
-    LOG(info) << "Sequence length: " << stats.sequence_length.mean() << " +/- "
-              << stats.sequence_length.stddev() << ENDLG;
-    LOG(info) << "Gap length: " << stats.gap_length.mean() << " +/- "
-              << stats.gap_length.stddev() << ENDLG;
-    LOG(info) << "Num sequences/user: " << stats.num_sequences.mean() << " +/- "
-              << stats.num_sequences.stddev() << ENDLG;
+    // sorts the actions (and any runs spilled to disk), and is shared by
+    // the communities of a batch
+    if (!pool)
+        pool = make_unique<parallel::thread_pool>();
 
-    return 0;
+    auto batch_iter
+        = std::find_if(args.begin() + 1, args.end(), [](util::string_view arg) {
+              return arg.size() > 8 && arg.substr(0, 8) == "--batch=";
+          });
+
+    if (batch_iter == args.end())
+        return extract_sequences(*folder_name_iter, args.back(), options,
+                                 *pool);
+
+    auto output_dir = batch_iter->substr(8);
+    std::vector<std::string> dumps;
+    std::copy_if(args.begin() + 1, args.end(), std::back_inserter(dumps),
+                 [](const std::string& arg) {
+                     return !arg.empty() && arg[0] != '-';
+                 });
+    auto jobs = find_communities(dumps, output_dir, options);
+    filesystem::make_directories(output_dir);
+
+    auto jobs_iter
+        = std::find_if(args.begin() + 1, args.end(), [](util::string_view arg) {
+              return arg.size() > 7 && arg.substr(0, 7) == "--jobs=";
+          });
+
+    std::size_t num_jobs = pool->size();
+    if (jobs_iter != args.end())
+        num_jobs = std::max<std::size_t>(1, std::stoul(jobs_iter->substr(7)));
+
+    // without a limit, the budget is the machine's memory
+    auto memory_budget = options.memory_limit;
+    if (!memory_budget)
+        memory_budget = static_cast<uint64_t>(sysconf(_SC_PHYS_PAGES))
+                        * static_cast<uint64_t>(sysconf(_SC_PAGE_SIZE));
+
+    LOG(info) << "Extracting " << jobs.size() << " communities with "
+              << num_jobs << " jobs" << ENDLG;
+    return extract_batch(jobs, num_jobs, memory_budget, options, *pool);
 }
+
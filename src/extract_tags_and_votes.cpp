@@ -13,80 +13,68 @@
 #include "meta/io/filesystem.h"
 #include "meta/logging/logger.h"
 #include "parsing.h"
+#include "tables.h"
 
 using namespace meta;
 
-inline util::string_view sv_or_blank(const util::optional<xml_string>& opt)
+inline util::string_view
+sv_or_blank(const util::optional<util::string_view>& opt)
 {
-    return opt ? opt->sv() : "";
+    return opt ? *opt : "";
 }
 
-void extract_votes(const std::string& folder)
+void extract_votes(const std::string& folder, const parse_options& options)
 {
-    auto filename = folder + "/Votes.xml.xz";
-    printing::progress progress{" > Extracting Votes: ",
-                                filesystem::file_size(filename)};
-    io::xzifstream input{filename};
-    xml_text_reader reader{input, progress};
+    auto table = find_table(folder, "Votes");
+    printing::progress progress{" > Extracting Votes: ", table.size};
+    static const auto schema = votes_table::schema().project(
+        {votes_table::PostId, votes_table::VoteTypeId,
+         votes_table::CreationDate});
+
+    auto reader = open_rows(table, schema, progress, options);
 
     std::ofstream output{"votes.csv"};
     output << "PostId,VoteTypeId,CreationDate\n";
-    while (reader.read_next())
+    while (reader->read_next())
     {
-        auto node_name = reader.node_name();
+        auto post_id = reader->as_view(votes_table::PostId);
+        auto vote_type = reader->as_u64(votes_table::VoteTypeId);
+        auto creation_date = reader->as_view(votes_table::CreationDate);
 
-        if (node_name == "votes")
+        if (!vote_type || !post_id)
             continue;
 
-        if (node_name != "row")
-            throw std::runtime_error{"unrecognized XML entity "
-                                     + node_name.to_string()};
-
-        auto post_id = reader.attribute("PostId");
-        auto vote_type = reader.attribute("VoteTypeId");
-        auto creation_date = reader.attribute("CreationDate");
-
-        if (vote_type->sv() == "2" || vote_type->sv() == "3"
-            || vote_type->sv() == "5")
+        if (*vote_type == 2 || *vote_type == 3 || *vote_type == 5)
         {
-            output << post_id->sv() << "," << vote_type->sv() << ","
-                   << creation_date->sv() << "\n";
+            output << *post_id << "," << *vote_type << ","
+                   << sv_or_blank(creation_date) << "\n";
         }
     }
 }
 
-void extract_posts(const std::string& folder)
+void extract_posts(const std::string& folder, const parse_options& options)
 {
-    auto filename = folder + "/Posts.xml.xz";
-    printing::progress progress{" > Extracting Posts: ",
-                                filesystem::file_size(filename)};
-    io::xzifstream input{filename};
-    xml_text_reader reader{input, progress};
+    auto table = find_table(folder, "Posts");
+    printing::progress progress{" > Extracting Posts: ", table.size};
+    auto reader = open_rows(table, posts_table::schema(), progress, options);
 
     std::ofstream output{"posts.csv"};
     output << "Id,PostTypeId,ParentId,CreationDate,OwnerUserId,Tags\n";
-    while (reader.read_next())
+    std::string tags;
+    while (reader->read_next())
     {
-        auto node_name = reader.node_name();
-
-        if (node_name == "posts")
-            continue;
+        auto id = reader->as_view(posts_table::Id);
+        auto post_type_id = reader->as_view(posts_table::PostTypeId);
+        auto parent_id = reader->as_view(posts_table::ParentId);
+        auto creation_date = reader->as_view(posts_table::CreationDate);
+        auto owner_user_id = reader->as_view(posts_table::OwnerUserId);
 
-        if (node_name != "row")
-            throw std::runtime_error{"unrecognized XML entity "
-                                     + node_name.to_string()};
-
-        auto id = reader.attribute("Id");
-        auto post_type_id = reader.attribute("PostTypeId");
-        auto parent_id = reader.attribute("ParentId");
-        auto creation_date = reader.attribute("CreationDate");
-        auto owner_user_id = reader.attribute("OwnerUserId");
-        auto tags = reader.attribute("Tags");
+        // tags are stored entity-encoded (e.g. "&lt;c++&gt;")
+        xml_unescape(sv_or_blank(reader->as_view(posts_table::Tags)), tags);
 
         output << sv_or_blank(id) << "," << sv_or_blank(post_type_id) << ","
                << sv_or_blank(parent_id) << "," << sv_or_blank(creation_date)
-               << "," << sv_or_blank(owner_user_id) << "," << sv_or_blank(tags)
-               << "\n";
+               << "," << sv_or_blank(owner_user_id) << "," << tags << "\n";
     }
 }
 
@@ -94,16 +82,50 @@ int main(int argc, char** argv)
 {
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " folder" << std::endl;
+        std::cerr << "Usage: " << argv[0]
+                  << " [--parse-threads=N] folder|archive.7z" << std::endl;
+        std::cerr << "\t--parse-threads=N\n"
+                  << "\t\tParse each table in chunks on N threads"
+                  << std::endl;
         return 1;
     }
 
     logging::set_cerr_logging();
 
-    std::string folder{argv[1]};
+    std::vector<std::string> args{argv, argv + argc};
+
+    auto folder_name_iter = std::find_if(
+        args.begin() + 1, args.end(),
+        [](const std::string& arg) { return !arg.empty() && arg[0] != '-'; });
+    if (folder_name_iter == args.end())
+    {
+        LOG(fatal) << "Could not determine folder argument" << ENDLG;
+        return 1;
+    }
+
+    auto parse_threads_iter
+        = std::find_if(args.begin() + 1, args.end(), [](util::string_view arg) {
+              return arg.size() > 16 && arg.substr(0, 16) == "--parse-threads=";
+          });
+
+    parse_options options;
+    std::unique_ptr<parallel::thread_pool> pool;
+    if (parse_threads_iter != args.end())
+    {
+        auto num_threads = std::stoul(parse_threads_iter->substr(16));
+        if (num_threads < 1)
+        {
+            LOG(fatal) << "--parse-threads must be at least 1" << ENDLG;
+            return 1;
+        }
+        pool = make_unique<parallel::thread_pool>(num_threads);
+        options.pool = pool.get();
+    }
+
+    const auto& folder = *folder_name_iter;
 
-    extract_votes(folder);
-    extract_posts(folder);
+    extract_votes(folder, options);
+    extract_posts(folder, options);
 
     return 0;
 }
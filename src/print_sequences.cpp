@@ -3,36 +3,17 @@
  * Prints the extracted sequences as a big JSON file.
  */
 
-#include <fstream>
 #include <iostream>
 
 #include "json.hpp"
 
-#include "actions.h"
-#include "meta/io/packed.h"
+#include "sequence_file.h"
+
+#include "meta/io/filesystem.h"
 
 using namespace nlohmann;
 using namespace meta;
 
-using action_sequence_type = std::vector<uint8_t>;
-using sessions_list = std::vector<action_sequence_type>;
-
-struct user_sessions
-{
-    user_id user;
-    sessions_list sessions;
-};
-
-template <class InputStream>
-uint64_t packed_read(InputStream& is, user_sessions& sessions)
-{
-    auto bytes = io::packed::read(is, sessions.user);
-    bytes += io::packed::read(is, sessions.sessions);
-    return bytes;
-}
-
-using training_data_type = std::vector<user_sessions>;
-
 int main(int argc, char** argv)
 {
     if (argc != 2)
@@ -41,17 +22,31 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    std::ifstream input{argv[1], std::ios::binary};
-    training_data_type training;
-    io::packed::read(input, training);
+    if (!filesystem::file_exists(argv[1]))
+    {
+        std::cerr << argv[1] << " not found" << std::endl;
+        return 1;
+    }
 
-    json output;
+    sequence_file sequences{argv[1]};
+    json output = json::array();
 
-    for (const auto& sessions : training)
+    for (std::size_t idx = 0; idx < sequences.num_users(); ++idx)
     {
         json obj;
-        obj["user"] = static_cast<uint64_t>(sessions.user);
-        obj["sessions"] = sessions.sessions;
+        // files from before the version 2 layout have no user ids
+        if (auto user = sequences.user(idx))
+            obj["user"] = static_cast<uint64_t>(*user);
+
+        json sessions = json::array();
+        for (std::size_t s = 0; s < sequences.num_sessions(idx); ++s)
+        {
+            json session = json::array();
+            for (const auto& type : sequences.session(idx, s))
+                session.push_back(static_cast<uint8_t>(type));
+            sessions.push_back(session);
+        }
+        obj["sessions"] = sessions;
         output.push_back(obj);
     }
 
@@ -7,103 +7,522 @@
  * by my other tools.
  */
 
-#include <archive.h>
-#include <archive_entry.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
+#include <sys/stat.h>
+
+#include "archive_file.h"
+#include "block_index.h"
+#include "columnar.h"
 #include "meta/io/filesystem.h"
-#include "meta/io/xzstream.h"
 #include "meta/logging/logger.h"
 #include "meta/util/progress.h"
+#include "meta/util/string_view.h"
+#include "output.h"
 
-class archive_ptr
+/**
+ * Aggregates the archive bytes consumed by every job into a single
+ * progress bar, with a line per finished archive, so that concurrent jobs
+ * do not fight over the terminal.
+ */
+class repack_progress
 {
   public:
-    archive_ptr() : a_{archive_read_new()}
+    repack_progress(uint64_t total_bytes, std::size_t num_archives)
+        : progress_{" > Repacking: ", total_bytes},
+          num_archives_{num_archives},
+          start_{std::chrono::steady_clock::now()}
     {
-        if (!a_)
-            throw std::runtime_error{"failed to construct archive"};
+        // nothing
     }
 
-    operator archive*()
+    void add(uint64_t bytes)
     {
-        return a_;
+        std::lock_guard<std::mutex> lock{mutex_};
+        progress_(done_ += bytes);
     }
 
-    ~archive_ptr()
+    void finished(const std::string& name, bool up_to_date)
     {
-        archive_read_free(a_);
+        std::lock_guard<std::mutex> lock{mutex_};
+        ++num_finished_;
+        LOG(progress) << "\r" << (up_to_date ? "Up to date: " : "Finished ")
+                      << name << " (" << num_finished_
+                      << "/" << num_archives_ << ", " << throughput()
+                      << " MB/s overall)\n"
+                      << ENDLG;
+    }
+
+    void end()
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        progress_.end();
+        LOG(info) << "Repacked " << done_ / 1024 / 1024 << " MB of archives at "
+                  << throughput() << " MB/s" << ENDLG;
     }
 
   private:
-    archive* a_;
+    double throughput() const
+    {
+        using namespace std::chrono;
+        auto elapsed = duration_cast<duration<double>>(steady_clock::now()
+                                                       - start_);
+        return static_cast<double>(done_) / 1024 / 1024
+               / std::max(elapsed.count(), 1e-3);
+    }
+
+    std::mutex mutex_;
+    meta::printing::progress progress_;
+    uint64_t done_ = 0;
+    std::size_t num_finished_ = 0;
+    const std::size_t num_archives_;
+    const std::chrono::steady_clock::time_point start_;
 };
 
-struct archive_file
+/**
+ * Reads the current entry of an archive, copying everything read through
+ * to an output sink and reporting progress as it goes.
+ */
+class entry_source : public input_source
 {
   public:
-    archive_file(const char* filename)
+    entry_source(archive_file& file, output_sink& output,
+                 repack_progress& progress, uint64_t& reported)
+        : file_(file), output_(output), progress_(progress), reported_(reported)
+    {
+        // nothing
+    }
+
+    std::size_t read(char* buffer, std::size_t len) override
+    {
+        auto num_read = file_.read_data(buffer, len);
+        output_.write(buffer, num_read);
+        total_ += num_read;
+
+        auto bytes_read = file_.bytes_read();
+        progress_.add(bytes_read - reported_);
+        reported_ = bytes_read;
+        return num_read;
+    }
+
+    /**
+     * @return the number of uncompressed bytes read so far
+     */
+    uint64_t total() const
     {
-        archive_read_support_format_all(a_);
-        archive_read_support_filter_all(a_);
+        return total_;
+    }
+
+  private:
+    archive_file& file_;
+    output_sink& output_;
+    repack_progress& progress_;
+    uint64_t& reported_;
+    uint64_t total_ = 0;
+};
+
+/**
+ * Settings that apply to every archive being repacked.
+ */
+struct repack_options
+{
+    codec out_codec = codec::XZ;
+    output_options output;
+    bool columnar = false;
+    /// repack entries even if their outputs are up to date
+    bool force = false;
+    /// check the checksums of outputs that look up to date
+    bool verify = false;
+};
 
-        if (archive_read_open_filename(a_, filename, 10240))
+/**
+ * The files repacking one archive entry produces. Each is written under a
+ * ".tmp" name and only renamed into place once complete, so an
+ * interrupted run never leaves a truncated output behind.
+ */
+struct entry_outputs
+{
+    entry_outputs(const std::string& folder, const std::string& path,
+                  const repack_options& options)
+        : source{folder + "/" + path},
+          table{source + codec_extension(options.out_codec)}
+    {
+        if (ends_with(path, ".xml"))
         {
-            throw std::runtime_error{"failed to open file: "
-                                     + std::string{filename}};
+            auto name = path.substr(0, path.size() - 4);
+            schema = find_schema(name);
+            if (schema)
+                column_dir = column_folder(folder, name);
         }
+
+        // a block index only pays off where the blocks can be decoded on
+        // their own: multi-block xz, or uncompressed XML
+        if (schema && options.out_codec != codec::ZSTD)
+            index = index_filename(table);
+        if (schema && options.columnar)
+            columns = column_dir;
     }
 
-    ~archive_file()
+    /**
+     * @return the file recording that the entry was repacked
+     */
+    std::string marker() const
     {
-        archive_read_close(a_);
+        return table + ".done";
     }
 
-    operator archive*()
+    /**
+     * @return whether every output is in place
+     */
+    bool exist() const
     {
-        return a_;
+        using meta::filesystem::file_exists;
+        return file_exists(table) && (index.empty() || file_exists(index))
+               && (columns.empty() || file_exists(columns));
     }
 
-  private:
-    archive_ptr a_;
+    /**
+     * Moves the finished outputs into place, and removes whatever an
+     * earlier run with other settings left of the entry: the extractors
+     * prefer columns and uncompressed tables, so a stale one would be
+     * read instead of the new table.
+     */
+    void commit() const
+    {
+        using namespace meta::filesystem;
+
+        rename_file(table + ".tmp", table);
+        if (!index.empty())
+            rename_file(index + ".tmp", index);
+        else
+            delete_file(index_filename(table));
+
+        if (!column_dir.empty())
+            remove_all(column_dir);
+        if (!columns.empty())
+            rename_file(columns + ".tmp", columns);
+
+        for (auto other : {codec::NONE, codec::ZSTD, codec::XZ})
+        {
+            auto name = source + codec_extension(other);
+            if (name == table)
+                continue;
+            delete_file(name);
+            delete_file(index_filename(name));
+            delete_file(name + ".done");
+        }
+    }
+
+    /// the entry's path under the output folder, without a codec extension
+    std::string source;
+    std::string table;
+    std::string index;
+    std::string columns;
+    /// where the entry's columns go, whether or not they are written
+    std::string column_dir;
+    const attribute_schema* schema = nullptr;
 };
 
-void repack_file(archive_file& file, archive_entry* entry,
-                 const std::string& folder)
+void repack_file(archive_file& file, const entry_outputs& outputs,
+                 const repack_options& options, repack_progress& progress,
+                 uint64_t& reported)
 {
-    using namespace meta;
-    auto path = archive_entry_pathname(entry);
-    auto filesize = archive_entry_size(entry);
-    auto full_path = folder + "/" + path + ".xz";
+    auto output = open_output(outputs.table + ".tmp", options.out_codec,
+                              options.output);
+    entry_source source{file, *output, progress, reported};
+
+    const auto* schema = outputs.schema;
+    auto indexed = !outputs.index.empty();
+    block_index index{options.output.block_size};
+
+    if (schema && (options.columnar || indexed))
+    {
+        auto id = schema->index("Id");
+        auto date = schema->index("CreationDate");
+        auto scanned
+            = options.columnar ? *schema : schema->project({id, date});
 
-    printing::progress progress{" > Repacking " + std::string{path} + ": ",
-                                static_cast<uint64_t>(filesize)};
+        // the row scanner pulls the table through source, so the
+        // compressed copy is written in the same pass
+        row_scanner reader{source, scanned};
+        std::unique_ptr<column_writer> writer;
+        if (options.columnar)
+        {
+            // clears out whatever an interrupted run left behind
+            meta::filesystem::remove_all(outputs.columns + ".tmp");
+            writer = meta::make_unique<column_writer>(outputs.columns + ".tmp",
+                                                      scanned);
+        }
+
+        while (reader.read_next())
+        {
+            if (writer)
+                writer->append(reader);
+            if (indexed)
+                index.add_row(reader.row_offset(), reader.as_u64(id),
+                              reader.as_timestamp(date));
+        }
+        if (writer)
+            writer->close();
+    }
+
+    // copies whatever is left (everything, if the rows were not scanned);
+    // large reads keep the encoder's worker threads fed
+    std::vector<char> buff(1024 * 1024);
+    while (source.read(&buff[0], buff.size()) > 0)
+    {
+        // nothing
+    }
+    output->close();
 
-    io::xzofstream output{full_path};
+    if (indexed)
+    {
+        index.finish(source.total());
+        index.save(outputs.index + ".tmp");
+    }
+    outputs.commit();
+}
 
-    char buff[10240];
-    uint64_t bytes = 0;
-    while (true)
+/**
+ * @return the CRC64 of a file's contents
+ */
+uint64_t file_crc64(const std::string& filename)
+{
+    std::ifstream input{filename, std::ios::binary};
+    std::vector<char> buff(1024 * 1024);
+    uint64_t crc = 0;
+    while (input.read(&buff[0], static_cast<std::streamsize>(buff.size()))
+           || input.gcount() > 0)
     {
-        auto res = archive_read_data(file, buff, sizeof(buff));
-        if (res < 0)
-            throw std::runtime_error{std::string{"failed to extract file: "}
-                                     + archive_error_string(file)};
+        crc = lzma_crc64(reinterpret_cast<const uint8_t*>(buff.data()),
+                         static_cast<std::size_t>(input.gcount()), crc);
+    }
+    return crc;
+}
+
+/**
+ * @return a description of what an entry's outputs are made from and
+ * how; an entry whose marker starts with the same description need not be
+ * repacked again
+ */
+std::string entry_stamp(const std::string& filename, archive_entry* entry,
+                        const repack_options& options)
+{
+    struct stat info;
+    if (::stat(filename.c_str(), &info) != 0)
+        throw std::runtime_error{"failed to stat " + filename};
 
-        if (res == 0)
-            break;
+    std::ostringstream stamp;
+    stamp << "archive-size " << info.st_size << '\n'
+          << "archive-mtime " << info.st_mtime << '\n'
+          << "entry-size " << archive_entry_size(entry) << '\n'
+          << "entry-mtime " << archive_entry_mtime(entry) << '\n'
+          << "codec " << static_cast<int>(options.out_codec) << '\n'
+          << "block-size " << options.output.block_size << '\n'
+          << "columnar " << options.columnar << '\n';
+    return stamp.str();
+}
 
-        progress(bytes += static_cast<uint64_t>(res));
+/**
+ * @return the modification time of a file, in seconds since the epoch
+ */
+int64_t file_mtime(const std::string& filename)
+{
+    struct stat info;
+    if (::stat(filename.c_str(), &info) != 0)
+        throw std::runtime_error{"failed to stat " + filename};
+    return static_cast<int64_t>(info.st_mtime);
+}
 
-        output.write(buff, res);
+/**
+ * Records that an entry's outputs are complete: its stamp, followed by the
+ * size, checksum and modification time of the repacked table.
+ */
+void write_marker(const entry_outputs& outputs, const std::string& stamp)
+{
+    {
+        std::ofstream marker{outputs.marker() + ".tmp"};
+        marker << stamp << "output-size "
+               << meta::filesystem::file_size(outputs.table) << '\n'
+               << "output-crc64 " << file_crc64(outputs.table) << '\n'
+               << "output-mtime " << file_mtime(outputs.table) << '\n';
+        if (!marker)
+            throw std::runtime_error{"failed to write " + outputs.marker()};
+    }
+    meta::filesystem::rename_file(outputs.marker() + ".tmp", outputs.marker());
+}
+
+/**
+ * @return whether an entry's outputs exist and were made from the same
+ * source, in the same way, as stamp describes, and the repacked table is
+ * still the one recorded: by its size and modification time, or, with
+ * verify, by its size and checksum
+ */
+bool is_current(const entry_outputs& outputs, const std::string& stamp,
+                bool verify)
+{
+    std::ifstream marker{outputs.marker()};
+    if (!marker || !outputs.exist())
+        return false;
+
+    std::string contents{std::istreambuf_iterator<char>{marker},
+                         std::istreambuf_iterator<char>{}};
+    if (contents.compare(0, stamp.size(), stamp) != 0)
+        return false;
+
+    std::istringstream rest{contents.substr(stamp.size())};
+    std::string key;
+    uint64_t size, crc;
+    int64_t mtime;
+    rest >> key >> size >> key >> crc >> key >> mtime;
+    if (!rest || meta::filesystem::file_size(outputs.table) != size)
+        return false;
+
+    if (verify)
+        return file_crc64(outputs.table) == crc;
+    return file_mtime(outputs.table) == mtime;
+}
+
+/**
+ * @return the name of an archive without its extension, e.g.
+ * "3dprinting.stackexchange.com"
+ */
+std::string archive_name(const std::string& filename)
+{
+    std::string name{filename};
+    auto pos = name.rfind('.');
+    if (pos != name.npos)
+        name.erase(pos, name.length() - pos);
+    return name;
+}
+
+/**
+ * @return the community an archive belongs to. StackOverflow's dump is
+ * split into one archive per table (e.g. "stackoverflow.com-Posts.7z"),
+ * all of which belong to "stackoverflow.com".
+ */
+std::string community_name(const std::string& filename)
+{
+    static const char* tables[] = {"Badges",   "Comments", "PostHistory",
+                                   "PostLinks", "Posts",    "Tags",
+                                   "Users",    "Votes"};
+
+    auto name = archive_name(filename);
+    auto pos = name.rfind('-');
+    if (pos == name.npos)
+        return name;
+
+    auto suffix = name.substr(pos + 1);
+    for (const auto& table : tables)
+    {
+        if (suffix == table)
+            return name.substr(0, pos);
     }
+    return name;
+}
+
+void repack_archive(const std::string& filename,
+                    const repack_options& options, repack_progress& progress)
+{
+    auto folder = "repacked/" + community_name(filename);
+    auto size = meta::filesystem::file_size(filename);
+
+    // 7z can only skip over entries without decompressing them while no
+    // data has been read yet, so the markers are all checked up front: an
+    // archive that is already up to date is never decompressed at all
+    std::unordered_set<std::string> current;
+    std::size_t num_entries = 0;
+    {
+        archive_file listing{filename.c_str()};
+        while (auto entry = listing.next_entry())
+        {
+            if (archive_entry_size(entry) == 0)
+                continue;
+
+            ++num_entries;
+            std::string path = archive_entry_pathname(entry);
+            if (!options.force
+                && is_current(entry_outputs{folder, path, options},
+                              entry_stamp(filename, entry, options),
+                              options.verify))
+                current.insert(path);
+        }
+    }
+
+    if (current.size() == num_entries)
+    {
+        progress.add(size);
+        progress.finished(archive_name(filename), true);
+        return;
+    }
+
+    archive_file file{filename.c_str()};
+    uint64_t reported = 0;
+    while (auto entry = file.next_entry())
+    {
+        std::string path = archive_entry_pathname(entry);
+        if (archive_entry_size(entry) == 0 || current.count(path))
+            continue;
+
+        entry_outputs outputs{folder, path, options};
+        meta::filesystem::delete_file(outputs.marker());
+        repack_file(file, outputs, options, progress, reported);
+        write_marker(outputs, entry_stamp(filename, entry, options));
+    }
+
+    if (size > reported)
+        progress.add(size - reported);
+    progress.finished(archive_name(filename), false);
 }
 
 int main(int argc, char** argv)
 {
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " filename.7z [filename2.7z...]"
+        std::cerr << "Usage: " << argv[0]
+                  << " [--codec=xz|zstd|none] [--block-size=MB] [--jobs=N] "
+                     "[--columnar] [--force] [--verify] "
+                     "filename.7z [filename2.7z...]"
+                  << std::endl;
+        std::cerr << "\t--codec=xz|zstd|none\n"
+                  << "\t\tCompression for the repacked tables (default xz). "
+                     "zstd decompresses several times faster; none is "
+                     "memory mapped by the extractors"
+                  << std::endl;
+        std::cerr << "\t--block-size=MB\n"
+                  << "\t\tSize of the independently compressed xz blocks, "
+                     "which are encoded on all cores and can be decoded in "
+                     "parallel (default 24)"
+                  << std::endl;
+        std::cerr << "\t--jobs=N\n"
+                  << "\t\tRepack up to N archives at once, largest first "
+                     "(default 1, or the number of parts of a split "
+                     "archive like stackoverflow.com's). The cores are "
+                     "split between the jobs' encoders"
+                  << std::endl;
+        std::cerr << "\t--columnar\n"
+                  << "\t\tAlso write the attributes the extractors use from "
+                     "Posts, Comments, PostHistory and Votes as fixed-width "
+                     "columns, which they read instead of the XML"
+                  << std::endl;
+        std::cerr << "\t--force\n"
+                  << "\t\tRepack every entry, even those already repacked "
+                     "from the same archive with the same settings"
+                  << std::endl;
+        std::cerr << "\t--verify\n"
+                  << "\t\tCheck the checksum of every table that is "
+                     "already repacked, instead of only its size and "
+                     "modification time, and repack it if it differs"
                   << std::endl;
         return 1;
     }
@@ -112,33 +531,125 @@ int main(int argc, char** argv)
 
     logging::set_cerr_logging();
 
-    for (int i = 1; i < argc; ++i)
-    {
-        archive_file file{argv[i]};
-        archive_entry* entry;
+    std::vector<std::string> args{argv + 1, argv + argc};
 
-        std::string folder{argv[i]};
-        auto pos = folder.rfind('.');
-        if (pos != folder.npos)
-            folder.erase(pos, folder.length() - pos);
+    auto codec_iter
+        = std::find_if(args.begin(), args.end(), [](util::string_view arg) {
+              return arg.size() > 8 && arg.substr(0, 8) == "--codec=";
+          });
 
-        LOG(progress) << "Repacking " << folder << "...\n" << ENDLG;
+    repack_options options;
+    if (codec_iter != args.end())
+        options.out_codec = parse_codec(codec_iter->substr(8));
 
-        filesystem::make_directories("repacked/" + folder);
-        while (true)
-        {
-            int res = archive_read_next_header(file, &entry);
-            if (res == ARCHIVE_EOF)
-                break;
+    auto block_size_iter
+        = std::find_if(args.begin(), args.end(), [](util::string_view arg) {
+              return arg.size() > 13 && arg.substr(0, 13) == "--block-size=";
+          });
 
-            if (res != ARCHIVE_OK)
-                throw std::runtime_error{std::string{"error reading archive: "}
-                                         + archive_error_string(file)};
+    if (block_size_iter != args.end())
+        options.output.block_size
+            = std::max<uint64_t>(1, std::stoull(block_size_iter->substr(13)))
+              * 1024 * 1024;
 
-            if (archive_entry_size(entry) > 0)
-                repack_file(file, entry, "repacked/" + folder);
+    auto jobs_iter
+        = std::find_if(args.begin(), args.end(), [](util::string_view arg) {
+              return arg.size() > 7 && arg.substr(0, 7) == "--jobs=";
+          });
+
+    std::size_t num_jobs = 1;
+    if (jobs_iter != args.end())
+        num_jobs = std::max<std::size_t>(1, std::stoul(jobs_iter->substr(7)));
+
+    options.columnar = std::find(args.begin(), args.end(), "--columnar")
+                       != args.end();
+    options.force
+        = std::find(args.begin(), args.end(), "--force") != args.end();
+    options.verify
+        = std::find(args.begin(), args.end(), "--verify") != args.end();
+
+    std::vector<std::pair<uint64_t, std::string>> archives;
+    for (const auto& arg : args)
+    {
+        if (arg.empty() || arg[0] == '-')
+            continue;
+
+        if (!filesystem::file_exists(arg))
+        {
+            LOG(fatal) << "Archive " << arg << " does not exist" << ENDLG;
+            return 1;
         }
+        archives.emplace_back(filesystem::file_size(arg), arg);
+    }
+
+    // starting the largest archives first keeps a single huge community
+    // from being the only job left running at the end
+    std::sort(archives.begin(), archives.end(),
+              [](const std::pair<uint64_t, std::string>& a,
+                 const std::pair<uint64_t, std::string>& b) {
+                  return a.first > b.first;
+              });
+
+    // a split community's archives write to the same folder, which is
+    // created up front so that concurrent jobs do not race to make it
+    std::unordered_map<std::string, std::size_t> num_parts;
+    for (const auto& archive : archives)
+    {
+        auto community = community_name(archive.second);
+        if (num_parts[community]++ == 0)
+            filesystem::make_directories("repacked/" + community);
+    }
+
+    // without --jobs, the parts of a split community (i.e.,
+    // stackoverflow.com) are still repacked concurrently
+    if (jobs_iter == args.end())
+    {
+        for (const auto& parts : num_parts)
+            num_jobs = std::max(num_jobs, parts.second);
     }
 
-    return 0;
+    num_jobs = std::min(num_jobs, archives.size());
+    if (num_jobs > 1)
+        options.output.threads = std::max(
+            1u, options.output.threads / static_cast<unsigned>(num_jobs));
+
+    uint64_t total_bytes = 0;
+    for (const auto& archive : archives)
+        total_bytes += archive.first;
+
+    LOG(progress) << "Repacking " << archives.size() << " archives with "
+                  << num_jobs << " jobs...\n"
+                  << ENDLG;
+
+    repack_progress progress{total_bytes, archives.size()};
+    std::atomic<std::size_t> next_archive{0};
+    std::atomic<bool> failed{false};
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < num_jobs; ++i)
+    {
+        workers.emplace_back([&]() {
+            for (auto idx = next_archive++; idx < archives.size();
+                 idx = next_archive++)
+            {
+                const auto& filename = archives[idx].second;
+                try
+                {
+                    repack_archive(filename, options, progress);
+                }
+                catch (const std::exception& ex)
+                {
+                    LOG(error) << "\rFailed to repack " << filename << ": "
+                               << ex.what() << ENDLG;
+                    failed = true;
+                }
+            }
+        });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+    progress.end();
+
+    return failed ? 1 : 0;
 }
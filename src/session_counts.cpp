@@ -18,6 +18,7 @@
 
 #include "actions.h"
 #include "cpptoml.h"
+#include "sequence_file.h"
 #include "meta/io/filesystem.h"
 #include "meta/logging/logger.h"
 #include "meta/math/fastapprox.h"
@@ -41,10 +42,6 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    using network_session_type = std::vector<action_type>;
-    using network_sequence_type = std::vector<network_session_type>;
-    using network_sequences_type = std::vector<network_sequence_type>;
-
     std::regex fname_regex{
         R"(sequences/([\w.]+)-sequences.bin.([0-9]{3}).bin)"};
 
@@ -68,24 +65,18 @@ int main(int argc, char** argv)
             return 1;
         }
 
-        std::ifstream input{argv[a], std::ios::binary};
-
-        // need to convert ordered sequences -> histograms
-        // could write a separate extractor program for this, but why bother
-        network_sequences_type sequences;
-        auto bytes = io::packed::read(input, sequences);
-        if (bytes == 0 || !input)
+        uint64_t network_sessions = 0;
+        try
         {
-            LOG(fatal) << "Failed to read file " << argv[a] << ENDLG;
+            network_sessions = sequence_file{argv[a]}.num_sessions();
+        }
+        catch (const std::exception& ex)
+        {
+            LOG(fatal) << "Failed to read file " << argv[a] << ": "
+                       << ex.what() << ENDLG;
             return 1;
         }
 
-        auto network_sessions = std::accumulate(
-            sequences.begin(), sequences.end(), uint64_t{0},
-            [](uint64_t num_sessions, const network_sequence_type& sequence) {
-                return num_sessions + sequence.size();
-            });
-
         auto output_name = "counts-by-month/" + fname_match[1].str() + ".csv";
         std::ofstream output;
         if (!filesystem::file_exists(output_name))